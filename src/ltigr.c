@@ -2,6 +2,16 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#if defined( _WIN32 )
+#  include <windows.h>
+#else
+#  include <pthread.h>
+#endif
 
 #include <lua.h>
 #include <lauxlib.h>
@@ -55,6 +65,280 @@ static inline TPixel check_pixel( lua_State* L, int idx )
 }
 
 
+/* temporary memory that is reclaimed by the garbage collector even
+ * if an error is raised */
+static void* ltigr_scratch( lua_State* L, size_t size )
+{
+  return lua_newuserdata( L, size > 0 ? size : 1 );
+}
+
+
+/* Checks for values taken from a table argument: the value is at
+ * stack index idx, errors are reported for argument arg and name the
+ * field key or, if key is NULL, the element index i. */
+static void ltigr_elem_error( lua_State* L, int arg, char const* key, lua_Integer i,
+                              char const* msg )
+{
+  if( key )
+  {
+    luaL_argerror( L, arg, lua_pushfstring( L, "%s for field '%s'", msg, key ) );
+  }
+  else
+  {
+    luaL_argerror( L, arg, lua_pushfstring( L, "%s at index %d", msg, (int)i ) );
+  }
+}
+
+
+static lua_Integer ltigr_check_elem_int( lua_State* L, int idx, int arg, char const* key,
+                                         lua_Integer i, lua_Integer low, lua_Integer high )
+{
+  int isnum = 0;
+  lua_Integer v = lua_tointegerx( L, idx, &isnum );
+  if( !isnum )
+  {
+    ltigr_elem_error( L, arg, key, i, "integer expected" );
+  }
+  else if( v < low || v > high )
+  {
+    ltigr_elem_error( L, arg, key, i, "integer out of range" );
+  }
+  return v;
+}
+
+
+static lua_Number ltigr_check_elem_number( lua_State* L, int idx, int arg, char const* key,
+                                           lua_Integer i )
+{
+  int isnum = 0;
+  lua_Number v = lua_tonumberx( L, idx, &isnum );
+  if( !isnum )
+  {
+    ltigr_elem_error( L, arg, key, i, "number expected" );
+  }
+  return v;
+}
+
+
+/* nil selects the default option def */
+static int ltigr_check_elem_option( lua_State* L, int idx, int arg, char const* key,
+                                    lua_Integer i, char const* def,
+                                    char const* const names[] )
+{
+  char const* name = lua_isnil( L, idx ) ? def : lua_tostring( L, idx );
+  int j = 0;
+  for( j = 0; name && names[ j ]; ++j )
+  {
+    if( strcmp( names[ j ], name ) == 0 )
+    {
+      return j;
+    }
+  }
+  ltigr_elem_error( L, arg, key, i, name ? lua_pushfstring( L, "invalid option '%s'", name )
+                                         : "string expected" );
+  return 0;
+}
+
+
+static void* ltigr_check_elem_object( lua_State* L, int idx, int arg, char const* key,
+                                      lua_Integer i, char const* tname )
+{
+  void* p = moon_testobject( L, idx, tname );
+  if( !p )
+  {
+    ltigr_elem_error( L, arg, key, i, lua_pushfstring( L, "%s expected", tname ) );
+  }
+  return p;
+}
+
+
+/* minimal mutex abstraction for objects shared between OS threads */
+#if defined( _WIN32 )
+typedef CRITICAL_SECTION ltigr_mutex;
+
+static int ltigr_mutex_init( ltigr_mutex* m )
+{
+  InitializeCriticalSection( m );
+  return 1;
+}
+
+static void ltigr_mutex_destroy( ltigr_mutex* m )
+{
+  DeleteCriticalSection( m );
+}
+
+static void ltigr_mutex_lock( ltigr_mutex* m )
+{
+  EnterCriticalSection( m );
+}
+
+static int ltigr_mutex_trylock( ltigr_mutex* m )
+{
+  return TryEnterCriticalSection( m ) != 0;
+}
+
+static void ltigr_mutex_unlock( ltigr_mutex* m )
+{
+  LeaveCriticalSection( m );
+}
+
+static SRWLOCK ltigr_global = SRWLOCK_INIT;
+
+static void ltigr_global_lock( void )
+{
+  AcquireSRWLockExclusive( &ltigr_global );
+}
+
+static void ltigr_global_unlock( void )
+{
+  ReleaseSRWLockExclusive( &ltigr_global );
+}
+#else
+typedef pthread_mutex_t ltigr_mutex;
+
+static int ltigr_mutex_init( ltigr_mutex* m )
+{
+  return pthread_mutex_init( m, NULL ) == 0;
+}
+
+static void ltigr_mutex_destroy( ltigr_mutex* m )
+{
+  pthread_mutex_destroy( m );
+}
+
+static void ltigr_mutex_lock( ltigr_mutex* m )
+{
+  pthread_mutex_lock( m );
+}
+
+static int ltigr_mutex_trylock( ltigr_mutex* m )
+{
+  return pthread_mutex_trylock( m ) == 0;
+}
+
+static void ltigr_mutex_unlock( ltigr_mutex* m )
+{
+  pthread_mutex_unlock( m );
+}
+
+static pthread_mutex_t ltigr_global = PTHREAD_MUTEX_INITIALIZER;
+
+static void ltigr_global_lock( void )
+{
+  pthread_mutex_lock( &ltigr_global );
+}
+
+static void ltigr_global_unlock( void )
+{
+  pthread_mutex_unlock( &ltigr_global );
+}
+#endif
+
+
+/* splits [0, n) into up to nthreads chunks and runs fn on each chunk,
+ * one of them on the calling thread; returns when all chunks are done */
+#define LTIGR_MAX_THREADS 64
+
+typedef struct {
+  void (*fn)( void* ctx, int begin, int end );
+  void* ctx;
+  int begin;
+  int end;
+} ltigr_task;
+
+#if defined( _WIN32 )
+typedef HANDLE ltigr_thread;
+
+static DWORD WINAPI ltigr_task_main( LPVOID p )
+{
+  ltigr_task* t = p;
+  t->fn( t->ctx, t->begin, t->end );
+  return 0;
+}
+
+static int ltigr_thread_start( ltigr_thread* t, ltigr_task* task )
+{
+  *t = CreateThread( NULL, 0, ltigr_task_main, task, 0, NULL );
+  return *t != NULL;
+}
+
+static void ltigr_thread_join( ltigr_thread* t )
+{
+  WaitForSingleObject( *t, INFINITE );
+  CloseHandle( *t );
+}
+#else
+typedef pthread_t ltigr_thread;
+
+static void* ltigr_task_main( void* p )
+{
+  ltigr_task* t = p;
+  t->fn( t->ctx, t->begin, t->end );
+  return NULL;
+}
+
+static int ltigr_thread_start( ltigr_thread* t, ltigr_task* task )
+{
+  return pthread_create( t, NULL, ltigr_task_main, task ) == 0;
+}
+
+static void ltigr_thread_join( ltigr_thread* t )
+{
+  pthread_join( *t, NULL );
+}
+#endif
+
+static void ltigr_parallel_for( int n, int nthreads,
+                                void (*fn)( void* ctx, int begin, int end ),
+                                void* ctx )
+{
+  ltigr_task tasks[ LTIGR_MAX_THREADS ];
+  ltigr_thread threads[ LTIGR_MAX_THREADS ];
+  int started[ LTIGR_MAX_THREADS ];
+  int i = 0;
+  if( nthreads > n )
+  {
+    nthreads = n;
+  }
+  if( nthreads > LTIGR_MAX_THREADS )
+  {
+    nthreads = LTIGR_MAX_THREADS;
+  }
+  if( nthreads <= 1 )
+  {
+    if( n > 0 )
+    {
+      fn( ctx, 0, n );
+    }
+    return;
+  }
+  for( i = 0; i < nthreads; ++i )
+  {
+    tasks[ i ].fn = fn;
+    tasks[ i ].ctx = ctx;
+    tasks[ i ].begin = (int)((int64_t)n * i / nthreads);
+    tasks[ i ].end = (int)((int64_t)n * (i + 1) / nthreads);
+  }
+  for( i = 1; i < nthreads; ++i )
+  {
+    /* if a thread can't be created, its chunk runs on this thread */
+    started[ i ] = ltigr_thread_start( threads + i, tasks + i );
+    if( !started[ i ] )
+    {
+      fn( ctx, tasks[ i ].begin, tasks[ i ].end );
+    }
+  }
+  fn( ctx, tasks[ 0 ].begin, tasks[ 0 ].end );
+  for( i = 1; i < nthreads; ++i )
+  {
+    if( started[ i ] )
+    {
+      ltigr_thread_join( threads + i );
+    }
+  }
+}
+
+
 static char const* const ltigr_window_option_names[] = {
   "fixed",
   "auto",
@@ -79,400 +363,3397 @@ static int const ltigr_window_option_values[] = {
 };
 
 
+/* additional blit modes implemented by this binding; they are stored
+ * in the blitMode field of the bitmap like Tigr's own modes, so the
+ * values must stay clear of enum TIGRBlitMode */
+enum {
+  LTIGR_ADDITIVE = 0x100,
+  LTIGR_MULTIPLY,
+  LTIGR_SCREEN,
+  LTIGR_SUBTRACT
+};
+
 static char const* const ltigr_blitmode_names[] = {
   "keep_alpha",
   "blend_alpha",
+  "additive",
+  "multiply",
+  "screen",
+  "subtract",
   NULL
 };
 
-static enum TIGRBlitMode const ltigr_blitmode_values[] = {
+static int const ltigr_blitmode_values[] = {
   TIGR_KEEP_ALPHA,
   TIGR_BLEND_ALPHA,
+  LTIGR_ADDITIVE,
+  LTIGR_MULTIPLY,
+  LTIGR_SCREEN,
+  LTIGR_SUBTRACT,
 };
 
 
-static void ltigr_free( void* p )
+static inline int ltigr_is_custom_blitmode( int mode )
 {
-  tigrFree( p );
+  return mode >= LTIGR_ADDITIVE;
 }
 
 
-static int ltigr_window( lua_State* L )
+static void ltigr_set_blitmode( Tigr* bitmap, int mode )
 {
-  int width = moon_checkint( L, 1, 0, INT_MAX );
-  int height = moon_checkint( L, 2, 0, INT_MAX );
-  char const* title = luaL_checkstring( L, 3 );
-  int flags = 0;
-  int i = 0;
-  for( i = 4; i <= lua_gettop( L ); ++i )
+  if( ltigr_is_custom_blitmode( mode ) )
   {
-    flags |= ltigr_window_option_values[
-      luaL_checkoption( L, i, NULL, ltigr_window_option_names )
-    ];
+    bitmap->blitMode = mode;
   }
+  else
   {
-    void** p = moon_newpointer( L, "tigrWindow", ltigr_free );
-    *p = tigrWindow( width, height, title, flags );
-    if( !*p )
-    {
-      luaL_error( L, "error creating tigrWindow" );
-    }
+    tigrBlitMode( bitmap, mode );
   }
-  return 1;
-}
-
-
-static int ltigr_closed( lua_State* L )
-{
-  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
-  lua_pushboolean( L, tigrClosed( window ) );
-  return 1;
-}
-
-
-static int ltigr_update( lua_State* L )
-{
-  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
-  tigrUpdate( window );
-  return 0;
 }
 
 
-static int ltigr_bitmap( lua_State* L )
+/* effective clip rectangle [x0,x1) x [y0,y1) of a bitmap */
+static void ltigr_clip_rect( Tigr const* bitmap, int* x0, int* y0, int* x1, int* y1 )
 {
-  int width = moon_checkint( L, 1, 0, INT_MAX );
-  int height = moon_checkint( L, 2, 0, INT_MAX );
-  void** p = moon_newpointer( L, "tigrBitmap", ltigr_free );
-  *p = tigrBitmap( width, height );
-  if( !*p )
+  *x0 = bitmap->cx < 0 ? 0 : bitmap->cx;
+  *y0 = bitmap->cy < 0 ? 0 : bitmap->cy;
+  *x1 = (bitmap->cw < 0 || bitmap->cw > bitmap->w - bitmap->cx) ? bitmap->w : bitmap->cx + bitmap->cw;
+  *y1 = (bitmap->ch < 0 || bitmap->ch > bitmap->h - bitmap->cy) ? bitmap->h : bitmap->cy + bitmap->ch;
+  if( *x1 < *x0 )
   {
-    luaL_error( L, "error creating tigrBitmap" );
+    *x1 = *x0;
+  }
+  if( *y1 < *y0 )
+  {
+    *y1 = *y0;
   }
-  return 1;
-}
-
-
-static void* ltigr_window_to_bitmap( void* p )
-{
-  return p; /* no pointer conversion necessary */
 }
 
 
-static int ltigr_bitmap_w( lua_State* L )
+/* clips a rectangle against the clip rectangle of a bitmap, returns
+ * zero if nothing is left */
+static int ltigr_clip_area( Tigr const* bitmap, int* x, int* y, int* w, int* h )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  int x0, y0, x1, y1;
+  ltigr_clip_rect( bitmap, &x0, &y0, &x1, &y1 );
+  if( *x < x0 )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->w );
-    return 1;
+    *w -= x0 - *x;
+    *x = x0;
   }
-  else
+  if( *y < y0 )
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'w'" );
-    return 0;
+    *h -= y0 - *y;
+    *y = y0;
   }
-}
-
-
-static int ltigr_bitmap_h( lua_State* L )
-{
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  if( *w > x1 - *x )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->h );
-    return 1;
+    *w = x1 - *x;
   }
-  else
+  if( *h > y1 - *y )
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'h'" );
-    return 0;
+    *h = y1 - *y;
   }
+  return *w > 0 && *h > 0;
 }
 
 
-static int ltigr_bitmap_cx( lua_State* L )
+/* clips a blit against the destination clip rectangle and the source
+ * bitmap bounds, returns zero if nothing is left */
+static int ltigr_clip_blit( Tigr const* dst, Tigr const* src, int* dx, int* dy,
+                            int* sx, int* sy, int* w, int* h )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  int x0, y0, x1, y1;
+  ltigr_clip_rect( dst, &x0, &y0, &x1, &y1 );
+  if( *dx < x0 )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->cx );
-    return 1;
+    *sx += x0 - *dx;
+    *w -= x0 - *dx;
+    *dx = x0;
   }
-  else
+  if( *dy < y0 )
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'cx'" );
-    return 0;
+    *sy += y0 - *dy;
+    *h -= y0 - *dy;
+    *dy = y0;
   }
-}
-
-
-static int ltigr_bitmap_cy( lua_State* L )
-{
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  if( *w > x1 - *dx )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->cy );
-    return 1;
+    *w = x1 - *dx;
   }
-  else
+  if( *h > y1 - *dy )
+  {
+    *h = y1 - *dy;
+  }
+  if( *sx >= src->w || *sy >= src->h )
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'cy'" );
     return 0;
   }
-}
-
-
-static int ltigr_bitmap_cw( lua_State* L )
-{
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  if( *w > src->w - *sx )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->cw );
-    return 1;
+    *w = src->w - *sx;
   }
-  else
+  if( *h > src->h - *sy )
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'cw'" );
-    return 0;
+    *h = src->h - *sy;
+  }
+  return *w > 0 && *h > 0;
+}
+
+
+/* 8 bit fixed point helpers (exact rounding of x/255) */
+static inline unsigned ltigr_div255( unsigned x )
+{
+  x += 128u;
+  return (x + (x >> 8)) >> 8;
+}
+
+static inline unsigned ltigr_mul8( unsigned a, unsigned b )
+{
+  return ltigr_div255( a * b );
+}
+
+/* converts a float opacity in [0,1] to 0-255 */
+static inline unsigned ltigr_alpha8( float alpha )
+{
+  return alpha <= 0.0f ? 0u : (alpha >= 1.0f ? 255u : (unsigned)(alpha * 255.0f + 0.5f));
+}
+
+static inline uint8_t ltigr_lerp8( unsigned d, unsigned s, unsigned a )
+{
+  return (uint8_t)ltigr_div255( d * (255u - a) + s * a );
+}
+
+
+/* per channel compositing operators: d is the destination value, s
+ * the (tinted) source value, and a the effective source alpha */
+static inline uint8_t ltigr_op_blend( unsigned d, unsigned s, unsigned a )
+{
+  return ltigr_lerp8( d, s, a );
+}
+
+static inline uint8_t ltigr_op_additive( unsigned d, unsigned s, unsigned a )
+{
+  unsigned v = d + ltigr_mul8( s, a );
+  return (uint8_t)(v > 255u ? 255u : v);
+}
+
+static inline uint8_t ltigr_op_multiply( unsigned d, unsigned s, unsigned a )
+{
+  return ltigr_lerp8( d, ltigr_mul8( d, s ), a );
+}
+
+static inline uint8_t ltigr_op_screen( unsigned d, unsigned s, unsigned a )
+{
+  return ltigr_lerp8( d, 255u - ltigr_mul8( 255u - d, 255u - s ), a );
+}
+
+static inline uint8_t ltigr_op_subtract( unsigned d, unsigned s, unsigned a )
+{
+  unsigned v = ltigr_mul8( s, a );
+  return (uint8_t)(d > v ? d - v : 0u);
+}
+
+
+/* The loop bodies are kept free of branches and function pointers, so
+ * that the compiler can vectorize them. sstep is 1 for blits and 0 for
+ * fills with a single color. Only "blend_alpha" touches the destination
+ * alpha channel. */
+#define LTIGR_BLEND_LOOP( op, blend_a ) \
+  for( i = 0; i < n; ++i ) \
+  { \
+    TPixel sp = s[ i * sstep ]; \
+    unsigned a = ltigr_mul8( ltigr_mul8( sp.a, tint.a ), alpha ); \
+    d[ i ].r = op( d[ i ].r, ltigr_mul8( sp.r, tint.r ), a ); \
+    d[ i ].g = op( d[ i ].g, ltigr_mul8( sp.g, tint.g ), a ); \
+    d[ i ].b = op( d[ i ].b, ltigr_mul8( sp.b, tint.b ), a ); \
+    if( blend_a ) \
+    { \
+      d[ i ].a = (uint8_t)(a + ltigr_mul8( d[ i ].a, 255u - a )); \
+    } \
+  }
+
+static void ltigr_blend_span( TPixel* d, TPixel const* s, int sstep, int n,
+                              int mode, TPixel tint, unsigned alpha )
+{
+  int i = 0;
+  switch( mode )
+  {
+    case TIGR_KEEP_ALPHA:
+      LTIGR_BLEND_LOOP( ltigr_op_blend, 0 )
+      break;
+    case LTIGR_ADDITIVE:
+      LTIGR_BLEND_LOOP( ltigr_op_additive, 0 )
+      break;
+    case LTIGR_MULTIPLY:
+      LTIGR_BLEND_LOOP( ltigr_op_multiply, 0 )
+      break;
+    case LTIGR_SCREEN:
+      LTIGR_BLEND_LOOP( ltigr_op_screen, 0 )
+      break;
+    case LTIGR_SUBTRACT:
+      LTIGR_BLEND_LOOP( ltigr_op_subtract, 0 )
+      break;
+    default: /* TIGR_BLEND_ALPHA */
+      LTIGR_BLEND_LOOP( ltigr_op_blend, 1 )
+      break;
+  }
+}
+
+#undef LTIGR_BLEND_LOOP
+
+
+static void ltigr_blend_blit( Tigr* dst, Tigr* src, int dx, int dy, int sx, int sy,
+                              int w, int h, TPixel tint, unsigned alpha )
+{
+  if( ltigr_clip_blit( dst, src, &dx, &dy, &sx, &sy, &w, &h ) )
+  {
+    int y = 0;
+    for( y = 0; y < h; ++y )
+    {
+      ltigr_blend_span( dst->pix + (size_t)(dy + y) * dst->w + dx,
+                        src->pix + (size_t)(sy + y) * src->w + sx, 1, w,
+                        dst->blitMode, tint, alpha );
+    }
+  }
+}
+
+
+static void ltigr_blend_fill( Tigr* dst, int x, int y, int w, int h, TPixel color )
+{
+  if( ltigr_clip_area( dst, &x, &y, &w, &h ) )
+  {
+    int i = 0;
+    for( i = 0; i < h; ++i )
+    {
+      ltigr_blend_span( dst->pix + (size_t)(y + i) * dst->w + x, &color, 0, w,
+                        dst->blitMode, tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF ), 255u );
+    }
+  }
+}
+
+
+static void ltigr_free( void* p )
+{
+  tigrFree( p );
+}
+
+
+static int ltigr_window( lua_State* L )
+{
+  int width = moon_checkint( L, 1, 0, INT_MAX );
+  int height = moon_checkint( L, 2, 0, INT_MAX );
+  char const* title = luaL_checkstring( L, 3 );
+  int flags = 0;
+  int i = 0;
+  for( i = 4; i <= lua_gettop( L ); ++i )
+  {
+    flags |= ltigr_window_option_values[
+      luaL_checkoption( L, i, NULL, ltigr_window_option_names )
+    ];
+  }
+  {
+    void** p = moon_newpointer( L, "tigrWindow", ltigr_free );
+    *p = tigrWindow( width, height, title, flags );
+    if( !*p )
+    {
+      luaL_error( L, "error creating tigrWindow" );
+    }
+  }
+  return 1;
+}
+
+
+/* Input recording and replay: while a session is active for a window,
+ * all input queries are answered from a per-frame snapshot, which is
+ * either taken from the live window state and written to a log file
+ * (recording) or read back from such a file (replay). The values
+ * returned by tigr.time are logged/replayed as well; a replayed frame
+ * that calls tigr.time more often than the recorded one raises an
+ * error. The log uses the native byte order. There is at most one
+ * session per Lua state. */
+#define LTIGR_INPUT_MAX_TOUCH 10
+#define LTIGR_INPUT_MAX_TIMES 65535 /* per frame */
+
+typedef struct {
+  Tigr* window;
+  FILE* file;
+  int replay;
+  int finished; /* replay log exhausted */
+  int32_t mx;
+  int32_t my;
+  int32_t buttons;
+  int ntouch;
+  TigrTouchPoint touch[ LTIGR_INPUT_MAX_TOUCH ];
+  uint8_t keys[ 256 ]; /* bit 0: down, bit 1: held */
+  int32_t chr;
+  float* times;
+  int ntimes;
+  int itime;
+  int maxtimes; /* allocated size of times */
+} ltigr_input;
+
+static char const ltigr_input_magic[ 8 ] = "LTIGRIN1";
+
+
+static void ltigr_input_write_times( ltigr_input* in );
+
+
+/* also used as destructor, so a recording that is never stopped
+ * still gets the times of its last frame */
+static void ltigr_input_close( void* p )
+{
+  ltigr_input* in = p;
+  if( in->file )
+  {
+    if( !in->replay )
+    {
+      ltigr_input_write_times( in );
+    }
+    fclose( in->file );
+    in->file = NULL;
+  }
+  free( in->times );
+  in->times = NULL;
+  in->maxtimes = 0;
+}
+
+
+static int ltigr_input_reserve( ltigr_input* in, int n )
+{
+  if( n > in->maxtimes )
+  {
+    int size = in->maxtimes ? in->maxtimes : 16;
+    float* times = NULL;
+    while( size < n )
+    {
+      size *= 2;
+    }
+    times = realloc( in->times, (size_t)size * sizeof( float ) );
+    if( !times )
+    {
+      return 0;
+    }
+    in->times = times;
+    in->maxtimes = size;
+  }
+  return 1;
+}
+
+
+/* returns the active session (for the given window, if not NULL) */
+static ltigr_input* ltigr_input_session( lua_State* L, Tigr* window )
+{
+  ltigr_input* in = NULL;
+  lua_getfield( L, LUA_REGISTRYINDEX, "ltigr.input" );
+  in = moon_testobject( L, -1, "tigrInputSession" );
+  lua_pop( L, 1 );
+  if( in && window && in->window != window )
+  {
+    in = NULL;
+  }
+  return in;
+}
+
+
+static void ltigr_input_snapshot( ltigr_input* in )
+{
+  int x = 0, y = 0, buttons = 0;
+  int i = 0;
+  tigrMouse( in->window, &x, &y, &buttons );
+  in->mx = x;
+  in->my = y;
+  in->buttons = buttons;
+  in->ntouch = tigrTouch( in->window, in->touch, LTIGR_INPUT_MAX_TOUCH );
+  for( i = 0; i < 256; ++i )
+  {
+    in->keys[ i ] = (uint8_t)((tigrKeyDown( in->window, i ) ? 1 : 0) |
+                              (tigrKeyHeld( in->window, i ) ? 2 : 0));
+  }
+  in->chr = tigrReadChar( in->window );
+}
+
+
+static void ltigr_input_write_state( ltigr_input* in )
+{
+  uint8_t ntouch = (uint8_t)in->ntouch;
+  uint16_t nkeys = 0;
+  int i = 0;
+  fwrite( &in->mx, sizeof( int32_t ), 1, in->file );
+  fwrite( &in->my, sizeof( int32_t ), 1, in->file );
+  fwrite( &in->buttons, sizeof( int32_t ), 1, in->file );
+  fwrite( &ntouch, 1, 1, in->file );
+  for( i = 0; i < in->ntouch; ++i )
+  {
+    int32_t xy[ 2 ];
+    xy[ 0 ] = in->touch[ i ].x;
+    xy[ 1 ] = in->touch[ i ].y;
+    fwrite( xy, sizeof( int32_t ), 2, in->file );
+  }
+  /* only keys that are down or held are logged */
+  for( i = 0; i < 256; ++i )
+  {
+    nkeys += in->keys[ i ] != 0;
+  }
+  fwrite( &nkeys, sizeof( nkeys ), 1, in->file );
+  for( i = 0; i < 256; ++i )
+  {
+    if( in->keys[ i ] )
+    {
+      uint8_t k[ 2 ];
+      k[ 0 ] = (uint8_t)i;
+      k[ 1 ] = in->keys[ i ];
+      fwrite( k, 1, 2, in->file );
+    }
+  }
+  fwrite( &in->chr, sizeof( int32_t ), 1, in->file );
+}
+
+
+static int ltigr_input_read_state( ltigr_input* in )
+{
+  uint8_t ntouch = 0;
+  uint16_t nkeys = 0;
+  int i = 0;
+  if( fread( &in->mx, sizeof( int32_t ), 1, in->file ) != 1 ||
+      fread( &in->my, sizeof( int32_t ), 1, in->file ) != 1 ||
+      fread( &in->buttons, sizeof( int32_t ), 1, in->file ) != 1 ||
+      fread( &ntouch, 1, 1, in->file ) != 1 ||
+      ntouch > LTIGR_INPUT_MAX_TOUCH )
+  {
+    return 0;
+  }
+  in->ntouch = ntouch;
+  for( i = 0; i < in->ntouch; ++i )
+  {
+    int32_t xy[ 2 ];
+    if( fread( xy, sizeof( int32_t ), 2, in->file ) != 2 )
+    {
+      return 0;
+    }
+    in->touch[ i ].x = xy[ 0 ];
+    in->touch[ i ].y = xy[ 1 ];
+  }
+  if( fread( &nkeys, sizeof( nkeys ), 1, in->file ) != 1 || nkeys > 256 )
+  {
+    return 0;
+  }
+  memset( in->keys, 0, sizeof( in->keys ) );
+  for( i = 0; i < nkeys; ++i )
+  {
+    uint8_t k[ 2 ];
+    if( fread( k, 1, 2, in->file ) != 2 )
+    {
+      return 0;
+    }
+    in->keys[ k[ 0 ] ] = k[ 1 ];
+  }
+  return fread( &in->chr, sizeof( int32_t ), 1, in->file ) == 1;
+}
+
+
+static void ltigr_input_write_times( ltigr_input* in )
+{
+  uint16_t n = (uint16_t)in->ntimes;
+  fwrite( &n, sizeof( n ), 1, in->file );
+  fwrite( in->times, sizeof( float ), n, in->file );
+  in->ntimes = 0;
+}
+
+
+static int ltigr_input_read_times( ltigr_input* in )
+{
+  uint16_t n = 0;
+  in->ntimes = 0;
+  in->itime = 0;
+  if( fread( &n, sizeof( n ), 1, in->file ) != 1 || !ltigr_input_reserve( in, n ) ||
+      fread( in->times, sizeof( float ), n, in->file ) != n )
+  {
+    return 0;
+  }
+  in->ntimes = n;
+  return 1;
+}
+
+
+/* advances the session to the next frame (called after tigrUpdate) */
+static void ltigr_input_next_frame( ltigr_input* in )
+{
+  if( in->replay )
+  {
+    if( !in->finished && (!ltigr_input_read_state( in ) || !ltigr_input_read_times( in )) )
+    {
+      in->finished = 1;
+    }
+  }
+  else if( in->file )
+  {
+    ltigr_input_write_times( in );
+    ltigr_input_snapshot( in );
+    ltigr_input_write_state( in );
+  }
+}
+
+
+static int ltigr_closed( lua_State* L )
+{
+  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
+  ltigr_input* in = ltigr_input_session( L, window );
+  /* a finished replay closes the window from the script's view */
+  lua_pushboolean( L, tigrClosed( window ) || (in && in->finished) );
+  return 1;
+}
+
+
+static int ltigr_update( lua_State* L )
+{
+  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
+  ltigr_input* in = NULL;
+  tigrUpdate( window );
+  in = ltigr_input_session( L, window );
+  if( in )
+  {
+    ltigr_input_next_frame( in );
+  }
+  return 0;
+}
+
+
+static int ltigr_bitmap( lua_State* L )
+{
+  int width = moon_checkint( L, 1, 0, INT_MAX );
+  int height = moon_checkint( L, 2, 0, INT_MAX );
+  void** p = moon_newpointer( L, "tigrBitmap", ltigr_free );
+  *p = tigrBitmap( width, height );
+  if( !*p )
+  {
+    luaL_error( L, "error creating tigrBitmap" );
+  }
+  return 1;
+}
+
+
+/* bulk pixel format conversion for raw pixel buffers */
+static char const* const ltigr_format_names[] = {
+  "rgba",
+  "bgra",
+  "rgb24",
+  "rgb565",
+  "gray8",
+  "premultiplied",
+  NULL
+};
+
+static int const ltigr_format_sizes[] = {
+  4,
+  4,
+  3,
+  2,
+  1,
+  4,
+};
+
+
+static void ltigr_import_rgba( TPixel* out, uint8_t const* in, int w )
+{
+  memcpy( out, in, (size_t)w * sizeof( TPixel ) );
+}
+
+static void ltigr_import_bgra( TPixel* out, uint8_t const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    out[ x ].r = in[ 4 * x + 2 ];
+    out[ x ].g = in[ 4 * x + 1 ];
+    out[ x ].b = in[ 4 * x ];
+    out[ x ].a = in[ 4 * x + 3 ];
+  }
+}
+
+static void ltigr_import_rgb24( TPixel* out, uint8_t const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    out[ x ].r = in[ 3 * x ];
+    out[ x ].g = in[ 3 * x + 1 ];
+    out[ x ].b = in[ 3 * x + 2 ];
+    out[ x ].a = 0xFFu;
+  }
+}
+
+static void ltigr_import_rgb565( TPixel* out, uint8_t const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    /* little endian, red in the most significant bits */
+    unsigned v = in[ 2 * x ] | ((unsigned)in[ 2 * x + 1 ] << 8);
+    unsigned r = (v >> 11) & 0x1Fu;
+    unsigned g = (v >> 5) & 0x3Fu;
+    unsigned b = v & 0x1Fu;
+    out[ x ].r = (uint8_t)((r << 3) | (r >> 2));
+    out[ x ].g = (uint8_t)((g << 2) | (g >> 4));
+    out[ x ].b = (uint8_t)((b << 3) | (b >> 2));
+    out[ x ].a = 0xFFu;
+  }
+}
+
+static void ltigr_import_gray8( TPixel* out, uint8_t const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    out[ x ].r = in[ x ];
+    out[ x ].g = in[ x ];
+    out[ x ].b = in[ x ];
+    out[ x ].a = 0xFFu;
+  }
+}
+
+static void ltigr_import_premultiplied( TPixel* out, uint8_t const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    unsigned a = in[ 4 * x + 3 ];
+    unsigned h = a / 2;
+    unsigned d = a ? a : 1u;
+    unsigned r = (in[ 4 * x ] * 255u + h) / d;
+    unsigned g = (in[ 4 * x + 1 ] * 255u + h) / d;
+    unsigned b = (in[ 4 * x + 2 ] * 255u + h) / d;
+    out[ x ].r = (uint8_t)(r > 255u ? 255u : r);
+    out[ x ].g = (uint8_t)(g > 255u ? 255u : g);
+    out[ x ].b = (uint8_t)(b > 255u ? 255u : b);
+    out[ x ].a = (uint8_t)a;
+  }
+}
+
+static void (* const ltigr_format_importers[])( TPixel*, uint8_t const*, int ) = {
+  ltigr_import_rgba,
+  ltigr_import_bgra,
+  ltigr_import_rgb24,
+  ltigr_import_rgb565,
+  ltigr_import_gray8,
+  ltigr_import_premultiplied,
+};
+
+
+static void ltigr_export_rgba( uint8_t* out, TPixel const* in, int w )
+{
+  memcpy( out, in, (size_t)w * sizeof( TPixel ) );
+}
+
+static void ltigr_export_bgra( uint8_t* out, TPixel const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    out[ 4 * x ] = in[ x ].b;
+    out[ 4 * x + 1 ] = in[ x ].g;
+    out[ 4 * x + 2 ] = in[ x ].r;
+    out[ 4 * x + 3 ] = in[ x ].a;
+  }
+}
+
+static void ltigr_export_rgb24( uint8_t* out, TPixel const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    out[ 3 * x ] = in[ x ].r;
+    out[ 3 * x + 1 ] = in[ x ].g;
+    out[ 3 * x + 2 ] = in[ x ].b;
+  }
+}
+
+static void ltigr_export_rgb565( uint8_t* out, TPixel const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    unsigned v = ((in[ x ].r & 0xF8u) << 8) | ((in[ x ].g & 0xFCu) << 3) | (in[ x ].b >> 3);
+    out[ 2 * x ] = (uint8_t)(v & 0xFFu);
+    out[ 2 * x + 1 ] = (uint8_t)(v >> 8);
+  }
+}
+
+static void ltigr_export_gray8( uint8_t* out, TPixel const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    /* BT.601 luma in 8 bit fixed point */
+    out[ x ] = (uint8_t)((in[ x ].r * 77u + in[ x ].g * 150u + in[ x ].b * 29u + 128u) >> 8);
+  }
+}
+
+static void ltigr_export_premultiplied( uint8_t* out, TPixel const* in, int w )
+{
+  int x = 0;
+  for( x = 0; x < w; ++x )
+  {
+    unsigned a = in[ x ].a;
+    out[ 4 * x ] = (uint8_t)ltigr_mul8( in[ x ].r, a );
+    out[ 4 * x + 1 ] = (uint8_t)ltigr_mul8( in[ x ].g, a );
+    out[ 4 * x + 2 ] = (uint8_t)ltigr_mul8( in[ x ].b, a );
+    out[ 4 * x + 3 ] = (uint8_t)a;
+  }
+}
+
+static void (* const ltigr_format_exporters[])( uint8_t*, TPixel const*, int ) = {
+  ltigr_export_rgba,
+  ltigr_export_bgra,
+  ltigr_export_rgb24,
+  ltigr_export_rgb565,
+  ltigr_export_gray8,
+  ltigr_export_premultiplied,
+};
+
+
+static int ltigr_bitmap_from( lua_State* L )
+{
+  size_t len = 0;
+  uint8_t const* data = (uint8_t const*)luaL_checklstring( L, 1, &len );
+  int width = moon_checkint( L, 2, 0, INT_MAX );
+  int height = moon_checkint( L, 3, 0, INT_MAX );
+  int format = luaL_checkoption( L, 4, NULL, ltigr_format_names );
+  size_t rowsize = (size_t)width * ltigr_format_sizes[ format ];
+  size_t stride = moon_optint( L, 5, 0, INT_MAX, rowsize );
+  void** p = NULL;
+  Tigr* bitmap = NULL;
+  int y = 0;
+  luaL_argcheck( L, stride >= rowsize, 5, "stride too small" );
+  luaL_argcheck( L, height == 0 || len >= stride * (height - 1) + rowsize, 1,
+                 "pixel data too short" );
+  p = moon_newpointer( L, "tigrBitmap", ltigr_free );
+  *p = tigrBitmap( width, height );
+  if( !*p )
+  {
+    luaL_error( L, "error creating tigrBitmap" );
+  }
+  bitmap = *p;
+  for( y = 0; y < height; ++y )
+  {
+    ltigr_format_importers[ format ]( bitmap->pix + (size_t)y * width,
+                                      data + y * stride, width );
+  }
+  return 1;
+}
+
+
+static int ltigr_export( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int format = luaL_checkoption( L, 2, NULL, ltigr_format_names );
+  size_t rowsize = (size_t)bitmap->w * ltigr_format_sizes[ format ];
+  size_t stride = moon_optint( L, 3, 0, INT_MAX, rowsize );
+  luaL_Buffer b;
+  uint8_t* out = NULL;
+  int y = 0;
+  luaL_argcheck( L, stride >= rowsize, 3, "stride too small" );
+  out = (uint8_t*)luaL_buffinitsize( L, &b, stride * bitmap->h );
+  for( y = 0; y < bitmap->h; ++y )
+  {
+    uint8_t* row = out + y * stride;
+    ltigr_format_exporters[ format ]( row, bitmap->pix + (size_t)y * bitmap->w,
+                                      bitmap->w );
+    memset( row + rowsize, 0, stride - rowsize );
+  }
+  luaL_pushresultsize( &b, stride * bitmap->h );
+  return 1;
+}
+
+
+static void* ltigr_window_to_bitmap( void* p )
+{
+  return p; /* no pointer conversion necessary */
+}
+
+
+/* A shared bitmap is reference counted pixel memory that may be
+ * referenced from multiple Lua states (and thus OS threads) at once.
+ * Every Lua state gets its own handle userdata with its own Tigr
+ * header (so clip rectangle and blit mode are per handle), and the
+ * pixel memory is freed when the last handle is gone. Shared bitmaps
+ * are exported as integer ids that are never reused, and all live
+ * shared bitmaps are kept in a global list, so that ids passed to
+ * tigr.import_bitmap can be validated even after the bitmap is gone. */
+typedef struct ltigr_shared {
+  uint64_t id;
+  Tigr* bitmap; /* owns the pixel memory */
+  ltigr_mutex lock; /* user-visible lock/unlock */
+  int refcount; /* protected by the global lock */
+  struct ltigr_shared* next;
+} ltigr_shared;
+
+typedef struct {
+  Tigr header; /* per handle view of the shared pixels */
+  ltigr_shared* shared;
+  int locked; /* does this handle currently hold the lock? */
+} ltigr_shared_handle;
+
+/* both protected by the global lock */
+static ltigr_shared* ltigr_shared_list = NULL;
+static uint64_t ltigr_shared_last_id = 0;
+
+
+static ltigr_shared* ltigr_shared_new( int width, int height )
+{
+  ltigr_shared* shared = malloc( sizeof( *shared ) );
+  if( shared )
+  {
+    shared->bitmap = tigrBitmap( width, height );
+    shared->refcount = 1;
+    if( !shared->bitmap )
+    {
+      free( shared );
+      return NULL;
+    }
+    if( !ltigr_mutex_init( &shared->lock ) )
+    {
+      tigrFree( shared->bitmap );
+      free( shared );
+      return NULL;
+    }
+    ltigr_global_lock();
+    shared->id = ++ltigr_shared_last_id;
+    shared->next = ltigr_shared_list;
+    ltigr_shared_list = shared;
+    ltigr_global_unlock();
+  }
+  return shared;
+}
+
+
+/* takes a new reference if id belongs to a live shared bitmap */
+static ltigr_shared* ltigr_shared_lookup( uint64_t id )
+{
+  ltigr_shared* shared = NULL;
+  ltigr_global_lock();
+  for( shared = ltigr_shared_list; shared != NULL; shared = shared->next )
+  {
+    if( shared->id == id )
+    {
+      ++shared->refcount;
+      break;
+    }
+  }
+  ltigr_global_unlock();
+  return shared;
+}
+
+
+static void ltigr_shared_unref( ltigr_shared* shared )
+{
+  int refcount = 0;
+  ltigr_global_lock();
+  refcount = --shared->refcount;
+  if( refcount == 0 )
+  {
+    ltigr_shared** pp = &ltigr_shared_list;
+    while( *pp != shared )
+    {
+      pp = &(*pp)->next;
+    }
+    *pp = shared->next;
+  }
+  ltigr_global_unlock();
+  if( refcount == 0 )
+  {
+    ltigr_mutex_destroy( &shared->lock );
+    tigrFree( shared->bitmap );
+    free( shared );
+  }
+}
+
+
+static void ltigr_shared_release( void* p )
+{
+  ltigr_shared_handle* h = p;
+  if( h->shared )
+  {
+    if( h->locked )
+    {
+      ltigr_mutex_unlock( &h->shared->lock );
+    }
+    ltigr_shared_unref( h->shared );
+  }
+}
+
+
+static ltigr_shared_handle* ltigr_new_shared_handle( lua_State* L )
+{
+  ltigr_shared_handle* h = moon_newobject( L, "tigrSharedBitmap", ltigr_shared_release );
+  h->shared = NULL;
+  h->locked = 0;
+  return h;
+}
+
+
+static void ltigr_init_shared_handle( ltigr_shared_handle* h, ltigr_shared* shared )
+{
+  h->shared = shared;
+  h->header = *shared->bitmap;
+  tigrClip( &h->header, 0, 0, h->header.w, h->header.h );
+  tigrBlitMode( &h->header, TIGR_BLEND_ALPHA );
+}
+
+
+static int ltigr_shared_bitmap( lua_State* L )
+{
+  int width = moon_checkint( L, 1, 0, INT_MAX );
+  int height = moon_checkint( L, 2, 0, INT_MAX );
+  ltigr_shared_handle* h = ltigr_new_shared_handle( L );
+  ltigr_shared* shared = ltigr_shared_new( width, height );
+  if( !shared )
+  {
+    luaL_error( L, "error creating tigrSharedBitmap" );
+  }
+  ltigr_init_shared_handle( h, shared );
+  return 1;
+}
+
+
+static int ltigr_import_bitmap( lua_State* L )
+{
+  lua_Integer id = luaL_checkinteger( L, 1 );
+  ltigr_shared* shared = NULL;
+  ltigr_shared_handle* h = ltigr_new_shared_handle( L );
+  shared = id > 0 ? ltigr_shared_lookup( (uint64_t)id ) : NULL;
+  if( !shared )
+  {
+    luaL_argerror( L, 1, "invalid or expired shared bitmap handle" );
+  }
+  ltigr_init_shared_handle( h, shared );
+  return 1;
+}
+
+
+/* the exported id does not own a reference, it can be imported as
+ * long as any handle to the shared bitmap is alive */
+static int ltigr_shared_export( lua_State* L )
+{
+  ltigr_shared_handle* h = moon_checkobject( L, 1, "tigrSharedBitmap" );
+  lua_pushinteger( L, (lua_Integer)h->shared->id );
+  return 1;
+}
+
+
+static int ltigr_shared_lock( lua_State* L )
+{
+  ltigr_shared_handle* h = moon_checkobject( L, 1, "tigrSharedBitmap" );
+  if( h->locked )
+  {
+    luaL_error( L, "tigrSharedBitmap is already locked by this handle" );
+  }
+  ltigr_mutex_lock( &h->shared->lock );
+  h->locked = 1;
+  return 0;
+}
+
+
+static int ltigr_shared_try_lock( lua_State* L )
+{
+  ltigr_shared_handle* h = moon_checkobject( L, 1, "tigrSharedBitmap" );
+  if( h->locked )
+  {
+    luaL_error( L, "tigrSharedBitmap is already locked by this handle" );
+  }
+  h->locked = ltigr_mutex_trylock( &h->shared->lock );
+  lua_pushboolean( L, h->locked );
+  return 1;
+}
+
+
+static int ltigr_shared_unlock( lua_State* L )
+{
+  ltigr_shared_handle* h = moon_checkobject( L, 1, "tigrSharedBitmap" );
+  if( !h->locked )
+  {
+    luaL_error( L, "tigrSharedBitmap is not locked by this handle" );
+  }
+  h->locked = 0;
+  ltigr_mutex_unlock( &h->shared->lock );
+  return 0;
+}
+
+
+static void* ltigr_shared_to_bitmap( void* p )
+{
+  ltigr_shared_handle* h = p;
+  return &h->header;
+}
+
+
+static int ltigr_bitmap_w( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->w );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'w'" );
+    return 0;
+  }
+}
+
+
+static int ltigr_bitmap_h( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->h );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'h'" );
+    return 0;
+  }
+}
+
+
+static int ltigr_bitmap_cx( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->cx );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'cx'" );
+    return 0;
+  }
+}
+
+
+static int ltigr_bitmap_cy( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->cy );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'cy'" );
+    return 0;
+  }
+}
+
+
+static int ltigr_bitmap_cw( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->cw );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'cw'" );
+    return 0;
   }
 }
 
 
 static int ltigr_bitmap_ch( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, bitmap->ch );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'ch'" );
+    return 0;
+  }
+}
+
+
+static int ltigr_bitmap_blitmode( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    size_t i = 0;
+    for( i = 0; i < (sizeof( ltigr_blitmode_values )/sizeof( *ltigr_blitmode_values )); ++i )
+    {
+      if( bitmap->blitMode == ltigr_blitmode_values[ i ] )
+      {
+        lua_pushstring( L, ltigr_blitmode_names[ i ] );
+        return 1;
+      }
+    }
+#if 1
+    /* raising an error here is probably safest */
+    luaL_error( L, "unknown blitmode in bitmap/window" );
+#endif
+    lua_pushnil( L );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    int mode = ltigr_blitmode_values[
+      luaL_checkoption( L, 3, NULL, ltigr_blitmode_names )
+    ];
+    ltigr_set_blitmode( bitmap, mode );
+    return 0;
+  }
+}
+
+
+static int ltigr_get( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  lua_pushinteger( L, tp2p( tigrGet( bitmap, x, y ) ) );
+  return 1;
+}
+
+
+/* blends a single pixel with the given coverage (0-255), honouring
+ * the clip rectangle [x0,x1) x [y0,y1) and the blit mode */
+static inline void ltigr_plot_cov( Tigr* bitmap, int x0, int y0, int x1, int y1,
+                                   int x, int y, TPixel color, unsigned cov )
+{
+  if( cov > 0 && x >= x0 && x < x1 && y >= y0 && y < y1 )
+  {
+    ltigr_blend_span( bitmap->pix + (size_t)y * bitmap->w + x, &color, 0, 1,
+                      bitmap->blitMode, tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF ), cov );
+  }
+}
+
+
+/* Liang-Barsky clipping of a segment against a rectangle, returns
+ * zero if nothing is left */
+static int ltigr_clip_segment( double* x0, double* y0, double* x1, double* y1,
+                               double xmin, double ymin, double xmax, double ymax )
+{
+  double t0 = 0.0;
+  double t1 = 1.0;
+  double dx = *x1 - *x0;
+  double dy = *y1 - *y0;
+  double p[ 4 ];
+  double q[ 4 ];
+  int i = 0;
+  p[ 0 ] = -dx; q[ 0 ] = *x0 - xmin;
+  p[ 1 ] = dx; q[ 1 ] = xmax - *x0;
+  p[ 2 ] = -dy; q[ 2 ] = *y0 - ymin;
+  p[ 3 ] = dy; q[ 3 ] = ymax - *y0;
+  for( i = 0; i < 4; ++i )
+  {
+    if( p[ i ] == 0.0 )
+    {
+      if( q[ i ] < 0.0 )
+      {
+        return 0;
+      }
+    }
+    else
+    {
+      double r = q[ i ] / p[ i ];
+      if( p[ i ] < 0.0 )
+      {
+        if( r > t1 )
+        {
+          return 0;
+        }
+        if( r > t0 )
+        {
+          t0 = r;
+        }
+      }
+      else
+      {
+        if( r < t0 )
+        {
+          return 0;
+        }
+        if( r < t1 )
+        {
+          t1 = r;
+        }
+      }
+    }
+  }
+  *x1 = *x0 + t1 * dx;
+  *y1 = *y0 + t1 * dy;
+  *x0 = *x0 + t0 * dx;
+  *y0 = *y0 + t0 * dy;
+  return 1;
+}
+
+
+static void ltigr_segment_bresenham( Tigr* bitmap, int cx0, int cy0, int cx1, int cy1,
+                                     double fx0, double fy0, double fx1, double fy1,
+                                     TPixel color, int skip_first )
+{
+  int x0 = (int)floor( fx0 + 0.5 );
+  int y0 = (int)floor( fy0 + 0.5 );
+  int x1 = (int)floor( fx1 + 0.5 );
+  int y1 = (int)floor( fy1 + 0.5 );
+  int dx = x1 > x0 ? x1 - x0 : x0 - x1;
+  int dy = y1 > y0 ? y0 - y1 : y1 - y0;
+  int sx = x0 < x1 ? 1 : -1;
+  int sy = y0 < y1 ? 1 : -1;
+  int err = dx + dy;
+  int e2 = 0;
+  for( ;; )
+  {
+    if( !skip_first )
+    {
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x0, y0, color, 255u );
+    }
+    skip_first = 0;
+    if( x0 == x1 && y0 == y1 )
+    {
+      break;
+    }
+    e2 = 2 * err;
+    if( e2 >= dy )
+    {
+      err += dy;
+      x0 += sx;
+    }
+    if( e2 <= dx )
+    {
+      err += dx;
+      y0 += sy;
+    }
+  }
+}
+
+
+static int ltigr_plot( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  TPixel pixel = check_pixel( L, 4 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    int x0, y0, x1, y1;
+    ltigr_clip_rect( bitmap, &x0, &y0, &x1, &y1 );
+    ltigr_plot_cov( bitmap, x0, y0, x1, y1, x, y, pixel, 255u );
+  }
+  else
+  {
+    tigrPlot( bitmap, x, y, pixel );
+  }
+  return 0;
+}
+
+
+static int ltigr_clear( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  TPixel color = check_pixel( L, 2 );
+  tigrClear( bitmap, color );
+  return 0;
+}
+
+
+static int ltigr_fill( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int w = moon_checkint( L, 4, 0, INT_MAX );
+  int h = moon_checkint( L, 5, 0, INT_MAX );
+  TPixel color = check_pixel( L, 6 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    ltigr_blend_fill( bitmap, x, y, w, h, color );
+  }
+  else
+  {
+    tigrFill( bitmap, x, y, w, h, color );
+  }
+  return 0;
+}
+
+
+/* line for the custom blit modes with the same geometry as tigrLine:
+ * the start pixel is drawn, the end pixel is not */
+static void ltigr_blend_line( Tigr* bitmap, int x0, int y0, int x1, int y1, TPixel color )
+{
+  int64_t dx = x1 > x0 ? (int64_t)x1 - x0 : (int64_t)x0 - x1;
+  int64_t dy = y1 > y0 ? (int64_t)y1 - y0 : (int64_t)y0 - y1;
+  int sx = x0 < x1 ? 1 : -1;
+  int sy = y0 < y1 ? 1 : -1;
+  int64_t err = dx - dy;
+  int64_t e2 = 0;
+  int cx0, cy0, cx1, cy1;
+  ltigr_clip_rect( bitmap, &cx0, &cy0, &cx1, &cy1 );
+  ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x0, y0, color, 255u );
+  while( x0 != x1 || y0 != y1 )
+  {
+    e2 = 2 * err;
+    if( e2 > -dy )
+    {
+      err -= dy;
+      x0 += sx;
+    }
+    if( e2 < dx )
+    {
+      err += dx;
+      y0 += sy;
+    }
+    if( x0 != x1 || y0 != y1 )
+    {
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x0, y0, color, 255u );
+    }
+  }
+}
+
+
+static int ltigr_line( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x0 = moon_checkint( L, 2, 0, INT_MAX );
+  int y0 = moon_checkint( L, 3, 0, INT_MAX );
+  int x1 = moon_checkint( L, 4, 0, INT_MAX );
+  int y1 = moon_checkint( L, 5, 0, INT_MAX );
+  TPixel color = check_pixel( L, 6 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    ltigr_blend_line( bitmap, x0, y0, x1, y1, color );
+  }
+  else
+  {
+    tigrLine( bitmap, x0, y0, x1, y1, color );
+  }
+  return 0;
+}
+
+
+/* Xiaolin Wu's anti-aliased line; if skip_first is set, the pixels
+ * along the minor axis at the start point are left out, so that
+ * consecutive segments don't blend shared end points twice */
+static void ltigr_segment_wu( Tigr* bitmap, int cx0, int cy0, int cx1, int cy1,
+                              double x0, double y0, double x1, double y1,
+                              TPixel color, int skip_first )
+{
+  int steep = fabs( y1 - y0 ) > fabs( x1 - x0 );
+  int swapped = 0;
+  double gradient = 0.0;
+  double y = 0.0;
+  int x = 0;
+  int xs = 0;
+  int xe = 0;
+  if( steep )
+  {
+    double t = x0; x0 = y0; y0 = t;
+    t = x1; x1 = y1; y1 = t;
+  }
+  if( x0 > x1 )
+  {
+    double t = x0; x0 = x1; x1 = t;
+    t = y0; y0 = y1; y1 = t;
+    swapped = 1;
+  }
+  gradient = x1 - x0 > 0.0 ? (y1 - y0) / (x1 - x0) : 1.0;
+  xs = (int)floor( x0 + 0.5 );
+  xe = (int)floor( x1 + 0.5 );
+  y = y0 + gradient * (xs - x0);
+  for( x = xs; x <= xe; ++x, y += gradient )
+  {
+    int iy = (int)floor( y );
+    unsigned f = (unsigned)((y - iy) * 255.0 + 0.5);
+    if( skip_first && x == (swapped ? xe : xs) )
+    {
+      continue;
+    }
+    if( steep )
+    {
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, iy, x, color, 255u - f );
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, iy + 1, x, color, f );
+    }
+    else
+    {
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x, iy, color, 255u - f );
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x, iy + 1, color, f );
+    }
+  }
+}
+
+
+/* coverage (0-255) of the pixel centered at (px, py) by a thick
+ * segment; like the thin lines, integer coordinates are pixel centers.
+ * Without anti-aliasing coverage is half-open: centers exactly on the
+ * edge only count on the top/left side, so a width of n covers n rows
+ * (or columns) of an axis-aligned line. */
+static inline unsigned ltigr_segment_cov( double px, double py, double ax, double ay,
+                                          double bx, double by, double hw, int aa, int round )
+{
+  double vx = bx - ax;
+  double vy = by - ay;
+  double len2 = vx * vx + vy * vy;
+  double t = len2 > 0.0 ? ((px - ax) * vx + (py - ay) * vy) / len2 : 0.0;
+  double dx = 0.0;
+  double dy = 0.0;
+  double d = 0.0;
+  if( t < 0.0 || t > 1.0 )
+  {
+    if( !round )
+    {
+      return 0;
+    }
+    t = t < 0.0 ? 0.0 : 1.0;
+  }
+  dx = px - (ax + t * vx);
+  dy = py - (ay + t * vy);
+  d = sqrt( dx * dx + dy * dy );
+  if( aa )
+  {
+    double c = hw + 0.5 - d;
+    return c <= 0.0 ? 0u : (c >= 1.0 ? 255u : (unsigned)(c * 255.0 + 0.5));
+  }
+  if( d == hw )
+  {
+    return dy < 0.0 || (dy == 0.0 && dx < 0.0) ? 255u : 0u;
+  }
+  return d < hw ? 255u : 0u;
+}
+
+
+/* narrows [*lo, *hi] to the x values where a <= k*x + c <= b */
+static void ltigr_span_clamp( double* lo, double* hi, double k, double c, double a, double b )
+{
+  if( k == 0.0 )
+  {
+    if( c < a || c > b )
+    {
+      *lo = 1.0;
+      *hi = 0.0;
+    }
+  }
+  else
+  {
+    double s0 = (a - c) / k;
+    double s1 = (b - c) / k;
+    if( s0 > s1 )
+    {
+      double t = s0; s0 = s1; s1 = t;
+    }
+    *lo = s0 > *lo ? s0 : *lo;
+    *hi = s1 < *hi ? s1 : *hi;
+  }
+}
+
+
+/* widens [*lo, *hi] by the chord of row py through the disk of
+ * radius rad around (cx, cy) */
+static void ltigr_span_disk( double* lo, double* hi, double py, double cx, double cy,
+                             double rad )
+{
+  double q = rad * rad - (py - cy) * (py - cy);
+  if( q >= 0.0 )
+  {
+    double hc = sqrt( q );
+    *lo = cx - hc < *lo ? cx - hc : *lo;
+    *hi = cx + hc > *hi ? cx + hc : *hi;
+  }
+}
+
+
+/* x range of row py that may be covered by a thick segment (a
+ * slightly conservative superset, the exact test is done per pixel) */
+static int ltigr_segment_span( double py, double ax, double ay, double bx, double by,
+                               double hw, int aa, int round, double* lo, double* hi )
+{
+  double vx = bx - ax;
+  double vy = by - ay;
+  double len2 = vx * vx + vy * vy;
+  double rad = hw + (aa ? 0.5 : 0.0) + 1e-6;
+  *lo = HUGE_VAL;
+  *hi = -HUGE_VAL;
+  if( len2 > 0.0 )
+  {
+    double len = sqrt( len2 );
+    double s0 = -HUGE_VAL;
+    double s1 = HUGE_VAL;
+    /* projection onto the segment in [0, len2] and distance from the
+     * supporting line at most rad, both linear in x */
+    ltigr_span_clamp( &s0, &s1, vx, (py - ay) * vy - ax * vx, -1e-9 * len2, len2 * (1.0 + 1e-9) );
+    ltigr_span_clamp( &s0, &s1, vy, -(py - ay) * vx - ax * vy, -rad * len, rad * len );
+    if( s0 <= s1 )
+    {
+      *lo = s0;
+      *hi = s1;
+    }
+  }
+  if( round || len2 <= 0.0 )
+  {
+    ltigr_span_disk( lo, hi, py, ax, ay, rad );
+    ltigr_span_disk( lo, hi, py, bx, by, rad );
+  }
+  return *lo <= *hi;
+}
+
+
+static void ltigr_segment_thick( Tigr* bitmap, int cx0, int cy0, int cx1, int cy1,
+                                 double const* p, int has_prev, double hw,
+                                 TPixel color, int aa, int round )
+{
+  double ax = p[ 0 ], ay = p[ 1 ], bx = p[ 2 ], by = p[ 3 ];
+  double fx0 = floor( (ax < bx ? ax : bx) - hw - 1.0 );
+  double fy0 = floor( (ay < by ? ay : by) - hw - 1.0 );
+  double fx1 = ceil( (ax > bx ? ax : bx) + hw + 1.0 );
+  double fy1 = ceil( (ay > by ? ay : by) + hw + 1.0 );
+  /* clamp the bounding box in floating point to avoid overflows */
+  int x0 = fx0 < cx0 ? cx0 : (int)fx0;
+  int y0 = fy0 < cy0 ? cy0 : (int)fy0;
+  int x1 = fx1 > cx1 ? cx1 : (int)fx1;
+  int y1 = fy1 > cy1 ? cy1 : (int)fy1;
+  int x = 0;
+  int y = 0;
+  for( y = y0; y < y1; ++y )
+  {
+    double lo = 0.0;
+    double hi = 0.0;
+    int xs = x0;
+    int xe = x1;
+    if( !ltigr_segment_span( y, ax, ay, bx, by, hw, aa, round, &lo, &hi ) )
+    {
+      continue;
+    }
+    /* only the pixels of this row that can be covered are tested */
+    lo = floor( lo );
+    hi = floor( hi ) + 1.0;
+    xs = lo > x0 ? (int)lo : x0;
+    xe = hi < x1 ? (int)hi : x1;
+    for( x = xs; x < xe; ++x )
+    {
+      double px = x;
+      double py = y;
+      unsigned cov = ltigr_segment_cov( px, py, ax, ay, bx, by, hw, aa, round );
+      if( cov > 0 && has_prev )
+      {
+        /* blend the joint with the previous segment only up to the
+         * maximum of both coverages */
+        unsigned prev = ltigr_segment_cov( px, py, p[ -2 ], p[ -1 ], ax, ay, hw, aa, round );
+        cov = cov > prev ? ((cov - prev) * 255u + (255u - prev) / 2) / (255u - prev) : 0u;
+      }
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, x, y, color, cov );
+    }
+  }
+}
+
+
+static char const* const ltigr_polyline_format_names[] = {
+  "double",
+  "float",
+  NULL
+};
+
+static char const* const ltigr_polyline_join_names[] = {
+  "round",
+  "none",
+  NULL
+};
+
+
+static int ltigr_polyline( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  TPixel color = check_pixel( L, 3 );
+  double width = 1.0;
+  int aa = 0;
+  int round = 1;
+  int format = 0;
+  double* pts = NULL;
+  size_t n = 0;
+  size_t i = 0;
+  int cx0, cy0, cx1, cy1;
+  if( !lua_isnoneornil( L, 4 ) )
+  {
+    luaL_checktype( L, 4, LUA_TTABLE );
+    lua_getfield( L, 4, "width" );
+    if( !lua_isnil( L, -1 ) )
+    {
+      width = ltigr_check_elem_number( L, -1, 4, "width", 0 );
+      if( !isfinite( width ) )
+      {
+        ltigr_elem_error( L, 4, "width", 0, "finite number expected" );
+      }
+    }
+    lua_getfield( L, 4, "aa" );
+    aa = lua_toboolean( L, -1 );
+    lua_getfield( L, 4, "join" );
+    round = ltigr_check_elem_option( L, -1, 4, "join", 0, "round",
+                                     ltigr_polyline_join_names ) == 0;
+    lua_getfield( L, 4, "format" );
+    format = ltigr_check_elem_option( L, -1, 4, "format", 0, "double",
+                                      ltigr_polyline_format_names );
+    lua_pop( L, 4 );
+  }
+  if( lua_type( L, 2 ) == LUA_TSTRING )
+  {
+    size_t len = 0;
+    char const* s = lua_tolstring( L, 2, &len );
+    size_t sz = format ? sizeof( float ) : sizeof( double );
+    n = len / sz;
+    luaL_argcheck( L, len % (2 * sz) == 0, 2, "incomplete coordinate pair" );
+    pts = ltigr_scratch( L, n * sizeof( double ) );
+    for( i = 0; i < n; ++i )
+    {
+      if( format )
+      {
+        float f;
+        memcpy( &f, s + i * sz, sz );
+        pts[ i ] = f;
+      }
+      else
+      {
+        memcpy( pts + i, s + i * sz, sz );
+      }
+    }
+  }
+  else
+  {
+    luaL_checktype( L, 2, LUA_TTABLE );
+    n = lua_rawlen( L, 2 );
+    luaL_argcheck( L, n % 2 == 0, 2, "incomplete coordinate pair" );
+    pts = ltigr_scratch( L, n * sizeof( double ) );
+    for( i = 0; i < n; ++i )
+    {
+      lua_rawgeti( L, 2, (lua_Integer)i + 1 );
+      pts[ i ] = ltigr_check_elem_number( L, -1, 2, NULL, (lua_Integer)i + 1 );
+      lua_pop( L, 1 );
+    }
+  }
+  ltigr_clip_rect( bitmap, &cx0, &cy0, &cx1, &cy1 );
+  for( i = 0; i + 3 < n; i += 2 )
+  {
+    double const* p = pts + i;
+    double m = width / 2.0 + 2.0; /* culling margin */
+    /* non-finite coordinates (e.g. NaN for missing samples) break
+     * the line strip */
+    int has_prev = i > 0 && isfinite( p[ -2 ] ) && isfinite( p[ -1 ] );
+    if( !isfinite( p[ 0 ] ) || !isfinite( p[ 1 ] ) ||
+        !isfinite( p[ 2 ] ) || !isfinite( p[ 3 ] ) )
+    {
+      continue;
+    }
+    if( (p[ 0 ] < cx0 - m && p[ 2 ] < cx0 - m) || (p[ 0 ] > cx1 + m && p[ 2 ] > cx1 + m) ||
+        (p[ 1 ] < cy0 - m && p[ 3 ] < cy0 - m) || (p[ 1 ] > cy1 + m && p[ 3 ] > cy1 + m) )
+    {
+      continue;
+    }
+    if( width > 1.0 )
+    {
+      ltigr_segment_thick( bitmap, cx0, cy0, cx1, cy1, p, has_prev,
+                           width / 2.0, color, aa, round );
+    }
+    else
+    {
+      double x0 = p[ 0 ], y0 = p[ 1 ], x1 = p[ 2 ], y1 = p[ 3 ];
+      if( ltigr_clip_segment( &x0, &y0, &x1, &y1, cx0 - 1.0, cy0 - 1.0, cx1, cy1 ) )
+      {
+        /* shared end points are only plotted once */
+        int skip_first = has_prev && x0 == p[ 0 ] && y0 == p[ 1 ];
+        if( aa )
+        {
+          ltigr_segment_wu( bitmap, cx0, cy0, cx1, cy1, x0, y0, x1, y1, color,
+                            skip_first );
+        }
+        else
+        {
+          ltigr_segment_bresenham( bitmap, cx0, cy0, cx1, cy1, x0, y0, x1, y1, color,
+                                   skip_first );
+        }
+      }
+    }
+  }
+  return 0;
+}
+
+
+static int ltigr_rect( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int w = moon_checkint( L, 4, 0, INT_MAX );
+  int h = moon_checkint( L, 5, 0, INT_MAX );
+  TPixel color = check_pixel( L, 6 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    /* every outline pixel is blended exactly once */
+    if( w > 0 && h > 0 )
+    {
+      ltigr_blend_fill( bitmap, x, y, w, 1, color );
+      if( h > 1 )
+      {
+        ltigr_blend_fill( bitmap, x, y + h - 1, w, 1, color );
+      }
+      if( h > 2 )
+      {
+        ltigr_blend_fill( bitmap, x, y + 1, 1, h - 2, color );
+        if( w > 1 )
+        {
+          ltigr_blend_fill( bitmap, x + w - 1, y + 1, 1, h - 2, color );
+        }
+      }
+    }
+  }
+  else
+  {
+    tigrRect( bitmap, x, y, w, h, color );
+  }
+  return 0;
+}
+
+
+static int ltigr_fill_rect( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int w = moon_checkint( L, 4, 0, INT_MAX );
+  int h = moon_checkint( L, 5, 0, INT_MAX );
+  TPixel color = check_pixel( L, 6 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    ltigr_blend_fill( bitmap, x, y, w, h, color );
+  }
+  else
+  {
+    tigrFillRect( bitmap, x, y, w, h, color );
+  }
+  return 0;
+}
+
+
+#define LTIGR_MAX_STOPS 64
+
+typedef struct {
+  double t;
+  TPixel color;
+} ltigr_stop;
+
+
+/* reads either two colors (idx, idx+1) or a flat table of position
+ * and color pairs (idx), returns the index of the next argument */
+static int ltigr_check_stops( lua_State* L, int idx, ltigr_stop* stops, int* n )
+{
+  if( lua_type( L, idx ) == LUA_TTABLE )
+  {
+    int len = (int)lua_rawlen( L, idx );
+    int i = 0;
+    luaL_argcheck( L, len >= 4 && len % 2 == 0 && len <= 2 * LTIGR_MAX_STOPS, idx,
+                   "invalid list of gradient stops" );
+    *n = len / 2;
+    for( i = 0; i < *n; ++i )
+    {
+      lua_rawgeti( L, idx, 2 * i + 1 );
+      lua_rawgeti( L, idx, 2 * i + 2 );
+      stops[ i ].t = ltigr_check_elem_number( L, -2, idx, NULL, 2 * i + 1 );
+      stops[ i ].color = p2tp( (uint32_t)ltigr_check_elem_int( L, -1, idx, NULL, 2 * i + 2,
+                                                               0, UINT32_MAX ) );
+      lua_pop( L, 2 );
+      luaL_argcheck( L, stops[ i ].t >= 0.0 && stops[ i ].t <= 1.0 &&
+                     (i == 0 || stops[ i ].t >= stops[ i - 1 ].t), idx,
+                     "gradient stops must be ascending in [0,1]" );
+    }
+    return idx + 1;
+  }
+  stops[ 0 ].t = 0.0;
+  stops[ 0 ].color = check_pixel( L, idx );
+  stops[ 1 ].t = 1.0;
+  stops[ 1 ].color = check_pixel( L, idx + 1 );
+  *n = 2;
+  return idx + 2;
+}
+
+
+static TPixel ltigr_ramp( ltigr_stop const* stops, int n, double t )
+{
+  int i = 0;
+  unsigned f = 0;
+  TPixel c;
+  if( t <= stops[ 0 ].t )
+  {
+    return stops[ 0 ].color;
+  }
+  if( t >= stops[ n - 1 ].t )
+  {
+    return stops[ n - 1 ].color;
+  }
+  while( t > stops[ i + 1 ].t )
+  {
+    ++i;
+  }
+  f = (unsigned)((t - stops[ i ].t) / (stops[ i + 1 ].t - stops[ i ].t) * 255.0 + 0.5);
+  c.r = ltigr_lerp8( stops[ i ].color.r, stops[ i + 1 ].color.r, f );
+  c.g = ltigr_lerp8( stops[ i ].color.g, stops[ i + 1 ].color.g, f );
+  c.b = ltigr_lerp8( stops[ i ].color.b, stops[ i + 1 ].color.b, f );
+  c.a = ltigr_lerp8( stops[ i ].color.a, stops[ i + 1 ].color.a, f );
+  return c;
+}
+
+
+static char const* const ltigr_gradient_names[] = {
+  "horizontal",
+  "vertical",
+  "radial",
+  NULL
+};
+
+
+static int ltigr_fill_gradient( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int w = moon_checkint( L, 4, 0, INT_MAX );
+  int h = moon_checkint( L, 5, 0, INT_MAX );
+  ltigr_stop stops[ LTIGR_MAX_STOPS ];
+  int n = 0;
+  int direction = luaL_checkoption( L, ltigr_check_stops( L, 6, stops, &n ),
+                                    "horizontal", ltigr_gradient_names );
+  TPixel const white = tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF );
+  int cx = x;
+  int cy = y;
+  int cw = w;
+  int ch = h;
+  int i = 0;
+  int j = 0;
+  if( !ltigr_clip_area( bitmap, &cx, &cy, &cw, &ch ) )
+  {
+    return 0;
+  }
+  if( direction == 1 ) /* vertical: one color per row */
+  {
+    for( j = cy; j < cy + ch; ++j )
+    {
+      TPixel c = ltigr_ramp( stops, n, h > 1 ? (double)(j - y) / (h - 1) : 0.0 );
+      ltigr_blend_span( bitmap->pix + (size_t)j * bitmap->w + cx, &c, 0, cw,
+                        bitmap->blitMode, white, 255u );
+    }
+  }
+  else if( direction == 0 ) /* horizontal: the same row over and over */
+  {
+    TPixel* row = ltigr_scratch( L, (size_t)cw * sizeof( TPixel ) );
+    for( i = 0; i < cw; ++i )
+    {
+      row[ i ] = ltigr_ramp( stops, n, w > 1 ? (double)(cx + i - x) / (w - 1) : 0.0 );
+    }
+    for( j = cy; j < cy + ch; ++j )
+    {
+      ltigr_blend_span( bitmap->pix + (size_t)j * bitmap->w + cx, row, 1, cw,
+                        bitmap->blitMode, white, 255u );
+    }
+  }
+  else /* radial: from the center to the corners */
+  {
+    TPixel lut[ 1024 ];
+    TPixel* row = ltigr_scratch( L, (size_t)cw * sizeof( TPixel ) );
+    double mx = x + w / 2.0;
+    double my = y + h / 2.0;
+    double r = sqrt( (w / 2.0) * (w / 2.0) + (h / 2.0) * (h / 2.0) );
+    double scale = r > 0.0 ? 1023.0 / r : 0.0;
+    for( i = 0; i < 1024; ++i )
+    {
+      lut[ i ] = ltigr_ramp( stops, n, i / 1023.0 );
+    }
+    for( j = cy; j < cy + ch; ++j )
+    {
+      double dy = j + 0.5 - my;
+      for( i = 0; i < cw; ++i )
+      {
+        double dx = cx + i + 0.5 - mx;
+        double d = sqrt( dx * dx + dy * dy ) * scale;
+        row[ i ] = lut[ d >= 1023.0 ? 1023 : (int)(d + 0.5) ];
+      }
+      ltigr_blend_span( bitmap->pix + (size_t)j * bitmap->w + cx, row, 1, cw,
+                        bitmap->blitMode, white, 255u );
+    }
+  }
+  return 0;
+}
+
+
+/* tiles a bitmap over a rectangle, with the tile origin at (x, y) */
+static int ltigr_fill_pattern( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int w = moon_checkint( L, 4, 0, INT_MAX );
+  int h = moon_checkint( L, 5, 0, INT_MAX );
+  Tigr* tile = moon_checkobject( L, 6, "tigrBitmap" );
+  TPixel const white = tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF );
+  int ox = x;
+  int oy = y;
+  int j = 0;
+  luaL_argcheck( L, tile->pix != bitmap->pix, 6, "source and destination must differ" );
+  if( tile->w <= 0 || tile->h <= 0 || !ltigr_clip_area( bitmap, &x, &y, &w, &h ) )
+  {
+    return 0;
+  }
+  for( j = 0; j < h; ++j )
+  {
+    int ty = (y + j - oy) % tile->h;
+    TPixel const* src = tile->pix + (size_t)ty * tile->w;
+    TPixel* out = bitmap->pix + (size_t)(y + j) * bitmap->w + x;
+    int tx = (x - ox) % tile->w;
+    int done = 0;
+    while( done < w )
+    {
+      int len = tile->w - tx < w - done ? tile->w - tx : w - done;
+      ltigr_blend_span( out + done, src + tx, 1, len, bitmap->blitMode, white, 255u );
+      done += len;
+      tx = 0;
+    }
+  }
+  return 0;
+}
+
+
+/* midpoint circle outline for the custom blit modes; pixels shared
+ * by several octants are only blended once */
+static void ltigr_blend_circle( Tigr* bitmap, int xc, int yc, int r, TPixel color )
+{
+  int64_t e = 1 - (int64_t)r;
+  int64_t dx = 0;
+  int64_t dy = -2 * (int64_t)r;
+  int64_t x = 0;
+  int64_t y = r;
+  int cx0, cy0, cx1, cy1;
+  ltigr_clip_rect( bitmap, &cx0, &cy0, &cx1, &cy1 );
+#define LTIGR_PLOT( px, py ) \
+  do { \
+    int64_t px_ = (px), py_ = (py); \
+    if( px_ >= cx0 && px_ < cx1 && py_ >= cy0 && py_ < cy1 ) \
+    { \
+      ltigr_plot_cov( bitmap, cx0, cy0, cx1, cy1, (int)px_, (int)py_, color, 255u ); \
+    } \
+  } while( 0 )
+  LTIGR_PLOT( xc, yc + y );
+  if( r > 0 )
+  {
+    LTIGR_PLOT( xc, yc - y );
+    LTIGR_PLOT( xc + y, yc );
+    LTIGR_PLOT( xc - y, yc );
+  }
+  while( x < y - 1 )
+  {
+    ++x;
+    if( e >= 0 )
+    {
+      --y;
+      dy += 2;
+      e += dy;
+    }
+    dx += 2;
+    e += dx + 1;
+    LTIGR_PLOT( xc + x, yc + y );
+    LTIGR_PLOT( xc - x, yc + y );
+    LTIGR_PLOT( xc + x, yc - y );
+    LTIGR_PLOT( xc - x, yc - y );
+    if( x != y )
+    {
+      LTIGR_PLOT( xc + y, yc + x );
+      LTIGR_PLOT( xc - y, yc + x );
+      LTIGR_PLOT( xc + y, yc - x );
+      LTIGR_PLOT( xc - y, yc - x );
+    }
+  }
+#undef LTIGR_PLOT
+}
+
+
+/* filled circle for the custom blit modes with the same geometry as
+ * tigrFillCircle, which draws a row of half width h as the line from
+ * xc-h+1 to xc+h (end pixel excluded) and nothing for r <= 0. The
+ * half width of every row inside the clip rectangle is collected
+ * first, so that every pixel is blended exactly once. */
+static void ltigr_blend_fill_circle( lua_State* L, Tigr* bitmap, int xc, int yc, int r,
+                                     TPixel color )
+{
+  int64_t e = 1 - (int64_t)r;
+  int64_t dx = 0;
+  int64_t dy = -2 * (int64_t)r;
+  int64_t x = 0;
+  int64_t y = r;
+  int cx0, cy0, cx1, cy1;
+  int kmin = 0;
+  int kmax = 0;
+  int* half = NULL;
+  int k = 0;
+  ltigr_clip_rect( bitmap, &cx0, &cy0, &cx1, &cy1 );
+  if( r <= 0 || cx1 <= cx0 || cy1 <= cy0 )
+  {
+    return;
+  }
+  /* range of row offsets from the center that are inside the clip */
+  if( yc < cy0 )
+  {
+    kmin = cy0 - yc;
+    kmax = cy1 - 1 - yc;
+  }
+  else if( yc >= cy1 )
+  {
+    kmin = yc - (cy1 - 1);
+    kmax = yc - cy0;
+  }
+  else
+  {
+    kmax = yc - cy0 > cy1 - 1 - yc ? yc - cy0 : cy1 - 1 - yc;
+  }
+  kmax = kmax < r ? kmax : r;
+  if( kmin > kmax )
+  {
+    return;
+  }
+  half = ltigr_scratch( L, (size_t)(kmax - kmin + 1) * sizeof( int ) );
+  for( k = 0; k <= kmax - kmin; ++k )
+  {
+    half[ k ] = -1;
+  }
+#define LTIGR_ROW( row, hw ) \
+  do { \
+    int64_t row_ = (row); \
+    if( row_ >= kmin && row_ <= kmax && (hw) > half[ row_ - kmin ] ) \
+    { \
+      half[ row_ - kmin ] = (int)(hw); \
+    } \
+  } while( 0 )
+  /* rows are recorded exactly where tigrFillCircle draws them */
+  LTIGR_ROW( 0, y );
+  while( x < y - 1 )
+  {
+    ++x;
+    if( e >= 0 )
+    {
+      --y;
+      dy += 2;
+      e += dy;
+      LTIGR_ROW( y, x );
+    }
+    dx += 2;
+    e += dx + 1;
+    if( x != y )
+    {
+      LTIGR_ROW( x, y );
+    }
+  }
+#undef LTIGR_ROW
+  for( k = kmin; k <= kmax; ++k )
+  {
+    int hw = half[ k - kmin ];
+    if( hw > 0 )
+    {
+      int64_t l = (int64_t)xc - hw + 1;
+      int64_t rr = (int64_t)xc + hw;
+      l = l < cx0 ? cx0 : l;
+      rr = rr > cx1 ? cx1 : rr;
+      if( l < rr )
+      {
+        if( (int64_t)yc + k < cy1 )
+        {
+          ltigr_blend_fill( bitmap, (int)l, yc + k, (int)(rr - l), 1, color );
+        }
+        if( k > 0 && (int64_t)yc - k >= cy0 )
+        {
+          ltigr_blend_fill( bitmap, (int)l, yc - k, (int)(rr - l), 1, color );
+        }
+      }
+    }
+  }
+}
+
+
+static int ltigr_circle( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int r = moon_checkint( L, 4, 0, INT_MAX );
+  TPixel color = check_pixel( L, 5 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    ltigr_blend_circle( bitmap, x, y, r, color );
+  }
+  else
+  {
+    tigrCircle( bitmap, x, y, r, color );
+  }
+  return 0;
+}
+
+
+static int ltigr_fill_circle( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int r = moon_checkint( L, 4, 0, INT_MAX );
+  TPixel color = check_pixel( L, 5 );
+  if( ltigr_is_custom_blitmode( bitmap->blitMode ) )
+  {
+    ltigr_blend_fill_circle( L, bitmap, x, y, r, color );
+  }
+  else
+  {
+    tigrFillCircle( bitmap, x, y, r, color );
+  }
+  return 0;
+}
+
+
+static inline int ltigr_color_match( TPixel p, TPixel ref, int tol )
+{
+  int dr = p.r - ref.r, dg = p.g - ref.g, db = p.b - ref.b, da = p.a - ref.a;
+  return dr <= tol && -dr <= tol && dg <= tol && -dg <= tol &&
+         db <= tol && -db <= tol && da <= tol && -da <= tol;
+}
+
+
+/* Scanline flood fill over the connected (4-neighbour) area of pixels
+ * within tol of the seed pixel, limited to the clip rectangle. Fills
+ * with *color unless color is NULL. Pushes the pixel count and the
+ * bounding box (or only 0 if the seed is outside of the clip). */
+static int ltigr_flood( lua_State* L, Tigr* bitmap, int sx, int sy, int tol,
+                        TPixel const* color )
+{
+  int x0, y0, x1, y1;
+  int bx0 = sx, by0 = sy, bx1 = sx, by1 = sy;
+  lua_Integer count = 0;
+  TPixel ref;
+  uint8_t* visited = NULL;
+  int* stack = NULL;
+  size_t top = 0;
+  size_t cap = 256;
+  int w = 0;
+  ltigr_clip_rect( bitmap, &x0, &y0, &x1, &y1 );
+  if( sx < x0 || sx >= x1 || sy < y0 || sy >= y1 )
+  {
+    lua_pushinteger( L, 0 );
+    return 1;
+  }
+  w = x1 - x0;
+  visited = ltigr_scratch( L, ((size_t)w * (y1 - y0) + 7) / 8 );
+  memset( visited, 0, ((size_t)w * (y1 - y0) + 7) / 8 );
+  stack = malloc( cap * 2 * sizeof( int ) );
+  if( !stack )
+  {
+    luaL_error( L, "memory allocation error" );
+  }
+  ref = bitmap->pix[ (size_t)sy * bitmap->w + sx ];
+  stack[ 0 ] = sx;
+  stack[ 1 ] = sy;
+  top = 1;
+#define LTIGR_VISITED( x, y ) \
+  (visited[ ((size_t)((y) - y0) * w + ((x) - x0)) >> 3 ] & (1u << ((((size_t)((y) - y0) * w + ((x) - x0))) & 7)))
+#define LTIGR_MATCH( x, y ) \
+  (!LTIGR_VISITED( x, y ) && ltigr_color_match( bitmap->pix[ (size_t)(y) * bitmap->w + (x) ], ref, tol ))
+  while( top > 0 )
+  {
+    int x = 0;
+    int y = 0;
+    int l = 0;
+    int r = 0;
+    int i = 0;
+    --top;
+    x = stack[ 2 * top ];
+    y = stack[ 2 * top + 1 ];
+    if( !LTIGR_MATCH( x, y ) )
+    {
+      continue;
+    }
+    for( l = x; l > x0 && LTIGR_MATCH( l - 1, y ); --l )
+      ;
+    for( r = x; r + 1 < x1 && LTIGR_MATCH( r + 1, y ); ++r )
+      ;
+    for( i = l; i <= r; ++i )
+    {
+      size_t bit = (size_t)(y - y0) * w + (i - x0);
+      visited[ bit >> 3 ] |= (uint8_t)(1u << (bit & 7));
+      if( color )
+      {
+        bitmap->pix[ (size_t)y * bitmap->w + i ] = *color;
+      }
+    }
+    count += r - l + 1;
+    bx0 = l < bx0 ? l : bx0;
+    bx1 = r > bx1 ? r : bx1;
+    by0 = y < by0 ? y : by0;
+    by1 = y > by1 ? y : by1;
+    /* push one seed per matching run in the rows above and below */
+    for( i = -1; i <= 1; i += 2 )
+    {
+      int ny = y + i;
+      int nx = l;
+      if( ny < y0 || ny >= y1 )
+      {
+        continue;
+      }
+      while( nx <= r )
+      {
+        if( LTIGR_MATCH( nx, ny ) )
+        {
+          if( top == cap )
+          {
+            int* s = realloc( stack, cap * 4 * sizeof( int ) );
+            if( !s )
+            {
+              free( stack );
+              luaL_error( L, "memory allocation error" );
+            }
+            stack = s;
+            cap *= 2;
+          }
+          stack[ 2 * top ] = nx;
+          stack[ 2 * top + 1 ] = ny;
+          ++top;
+          while( nx <= r && LTIGR_MATCH( nx, ny ) )
+          {
+            ++nx;
+          }
+        }
+        ++nx;
+      }
+    }
+  }
+#undef LTIGR_MATCH
+#undef LTIGR_VISITED
+  free( stack );
+  lua_pushinteger( L, count );
+  lua_pushinteger( L, bx0 );
+  lua_pushinteger( L, by0 );
+  lua_pushinteger( L, bx1 - bx0 + 1 );
+  lua_pushinteger( L, by1 - by0 + 1 );
+  return 5;
+}
+
+
+static int ltigr_flood_fill( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  TPixel color = check_pixel( L, 4 );
+  int tol = moon_optint( L, 5, 0, 255, 0 );
+  return ltigr_flood( L, bitmap, x, y, tol, &color );
+}
+
+
+static int ltigr_region( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int x = moon_checkint( L, 2, 0, INT_MAX );
+  int y = moon_checkint( L, 3, 0, INT_MAX );
+  int tol = moon_optint( L, 4, 0, 255, 0 );
+  return ltigr_flood( L, bitmap, x, y, tol, NULL );
+}
+
+
+static int ltigr_clip( lua_State* L )
+{
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  int cx = moon_checkint( L, 2, 0, INT_MAX );
+  int cy = moon_checkint( L, 3, 0, INT_MAX );
+  int cw = moon_checkint( L, 4, -1, INT_MAX );
+  int ch = moon_checkint( L, 5, -1, INT_MAX );
+  tigrClip( bitmap, cx, cy, cw, ch );
+  return 0;
+}
+
+
+static int ltigr_blit( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
+  int dx = moon_checkint( L, 3, 0, INT_MAX );
+  int dy = moon_checkint( L, 4, 0, INT_MAX );
+  int sx = moon_checkint( L, 5, 0, INT_MAX );
+  int sy = moon_checkint( L, 6, 0, INT_MAX );
+  int w = moon_checkint( L, 7, 0, INT_MAX );
+  int h = moon_checkint( L, 8, 0, INT_MAX );
+  if( ltigr_is_custom_blitmode( dest->blitMode ) )
+  {
+    ltigr_blend_blit( dest, src, dx, dy, sx, sy, w, h,
+                      tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF ), 255u );
+  }
+  else
+  {
+    tigrBlit( dest, src, dx, dy, sx, sy, w, h );
+  }
+  return 0;
+}
+
+
+static int ltigr_blit_alpha( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
+  int dx = moon_checkint( L, 3, 0, INT_MAX );
+  int dy = moon_checkint( L, 4, 0, INT_MAX );
+  int sx = moon_checkint( L, 5, 0, INT_MAX );
+  int sy = moon_checkint( L, 6, 0, INT_MAX );
+  int w = moon_checkint( L, 7, 0, INT_MAX );
+  int h = moon_checkint( L, 8, 0, INT_MAX );
+  float alpha = (float)luaL_checknumber( L, 9 );
+  if( ltigr_is_custom_blitmode( dest->blitMode ) )
+  {
+    ltigr_blend_blit( dest, src, dx, dy, sx, sy, w, h,
+                      tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF ), ltigr_alpha8( alpha ) );
+  }
+  else
+  {
+    tigrBlitAlpha( dest, src, dx, dy, sx, sy, w, h, alpha );
+  }
+  return 0;
+}
+
+
+static int ltigr_blit_tint( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
+  int dx = moon_checkint( L, 3, 0, INT_MAX );
+  int dy = moon_checkint( L, 4, 0, INT_MAX );
+  int sx = moon_checkint( L, 5, 0, INT_MAX );
+  int sy = moon_checkint( L, 6, 0, INT_MAX );
+  int w = moon_checkint( L, 7, 0, INT_MAX );
+  int h = moon_checkint( L, 8, 0, INT_MAX );
+  TPixel tint = check_pixel( L, 9 );
+  if( ltigr_is_custom_blitmode( dest->blitMode ) )
+  {
+    ltigr_blend_blit( dest, src, dx, dy, sx, sy, w, h, tint, 255u );
+  }
+  else
+  {
+    tigrBlitTint( dest, src, dx, dy, sx, sy, w, h, tint );
+  }
+  return 0;
+}
+
+
+static int ltigr_blitmode( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  int mode = ltigr_blitmode_values[
+      luaL_checkoption( L, 2, "blend_alpha", ltigr_blitmode_names )
+  ];
+  ltigr_set_blitmode( dest, mode );
+  return 0;
+}
+
+
+static Tigr* ltigr_check_same_size( lua_State* L, int idx, Tigr* dest )
+{
+  Tigr* src = dest;
+  if( !lua_isnoneornil( L, idx ) )
   {
-    /* __index */
-    lua_pushinteger( L, bitmap->ch );
-    return 1;
+    src = moon_checkobject( L, idx, "tigrBitmap" );
+    luaL_argcheck( L, src->w == dest->w && src->h == dest->h, idx,
+                   "bitmap size mismatch" );
+  }
+  return src;
+}
+
+
+/* horizontal box filter pass with running sums (clamped at the edges) */
+static void ltigr_box_rows( TPixel const* src, int sstride, TPixel* dst, int dstride,
+                            int w, int h, int r )
+{
+  uint64_t inv = ((UINT64_C( 1 ) << 24) + (2 * r + 1) / 2) / (2 * r + 1);
+  int x = 0;
+  int y = 0;
+  for( y = 0; y < h; ++y )
+  {
+    TPixel const* in = src + (size_t)y * sstride;
+    TPixel* out = dst + (size_t)y * dstride;
+    uint32_t sr = 0, sg = 0, sb = 0, sa = 0;
+    for( x = -r; x <= r; ++x )
+    {
+      TPixel p = in[ x < 0 ? 0 : (x >= w ? w - 1 : x) ];
+      sr += p.r; sg += p.g; sb += p.b; sa += p.a;
+    }
+    for( x = 0; x < w; ++x )
+    {
+      TPixel p_in = in[ x + r + 1 >= w ? w - 1 : x + r + 1 ];
+      TPixel p_out = in[ x - r < 0 ? 0 : x - r ];
+      out[ x ].r = (uint8_t)((sr * inv + (UINT64_C( 1 ) << 23)) >> 24);
+      out[ x ].g = (uint8_t)((sg * inv + (UINT64_C( 1 ) << 23)) >> 24);
+      out[ x ].b = (uint8_t)((sb * inv + (UINT64_C( 1 ) << 23)) >> 24);
+      out[ x ].a = (uint8_t)((sa * inv + (UINT64_C( 1 ) << 23)) >> 24);
+      sr += p_in.r - p_out.r;
+      sg += p_in.g - p_out.g;
+      sb += p_in.b - p_out.b;
+      sa += p_in.a - p_out.a;
+    }
+  }
+}
+
+
+/* vertical box filter pass; keeps one running sum per column and
+ * walks the rows, so the inner loops are contiguous and vectorizable */
+static void ltigr_box_cols( TPixel const* src, int sstride, TPixel* dst, int dstride,
+                            int w, int h, int r, uint32_t* sums )
+{
+  uint32_t inv = (uint32_t)(((UINT64_C( 1 ) << 16) + (2 * r + 1) / 2) / (2 * r + 1));
+  int x = 0;
+  int y = 0;
+  for( x = 0; x < 4 * w; ++x )
+  {
+    sums[ x ] = 0;
+  }
+  for( y = -r; y <= r; ++y )
+  {
+    uint8_t const* in = (uint8_t const*)(src + (size_t)(y < 0 ? 0 : (y >= h ? h - 1 : y)) * sstride);
+    for( x = 0; x < 4 * w; ++x )
+    {
+      sums[ x ] += in[ x ];
+    }
+  }
+  for( y = 0; y < h; ++y )
+  {
+    uint8_t* out = (uint8_t*)(dst + (size_t)y * dstride);
+    uint8_t const* in = (uint8_t const*)(src + (size_t)(y + r + 1 >= h ? h - 1 : y + r + 1) * sstride);
+    uint8_t const* old = (uint8_t const*)(src + (size_t)(y - r < 0 ? 0 : y - r) * sstride);
+    for( x = 0; x < 4 * w; ++x )
+    {
+      /* sums are at most 255*(2r+1), so the product fits for r < 128 */
+      out[ x ] = (uint8_t)((sums[ x ] * inv + (1u << 15)) >> 16);
+      sums[ x ] += in[ x ];
+      sums[ x ] -= old[ x ];
+    }
+  }
+}
+
+
+/* shared state for the (optionally multi-threaded) filter passes */
+typedef struct {
+  TPixel const* in;
+  int istride;
+  TPixel* tmp;
+  int tstride;
+  TPixel* out;
+  int ostride;
+  int w;
+  int h;
+  int r;
+  uint32_t* sums;
+  uint8_t const* lut[ 4 ];
+} ltigr_filter_job;
+
+
+static void ltigr_blur_rows( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  ltigr_box_rows( j->in + (size_t)begin * j->istride, j->istride,
+                  j->tmp + (size_t)begin * j->tstride, j->tstride,
+                  j->w, end - begin, j->r );
+}
+
+
+static void ltigr_blur_cols( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  ltigr_box_cols( j->tmp + begin, j->tstride, j->out + begin, j->ostride,
+                  end - begin, j->h, j->r, j->sums + 4 * (size_t)begin );
+}
+
+
+static char const* const ltigr_blur_names[] = {
+  "box",
+  "gaussian",
+  NULL
+};
+
+
+static int ltigr_blur( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  int r = moon_checkint( L, 2, 0, 127 );
+  int passes = luaL_checkoption( L, 3, "box", ltigr_blur_names ) ? 3 : 1;
+  Tigr* src = ltigr_check_same_size( L, 4, dest );
+  int nthreads = moon_optint( L, 5, 1, LTIGR_MAX_THREADS, 1 );
+  int x0, y0, x1, y1;
+  ltigr_clip_rect( dest, &x0, &y0, &x1, &y1 );
+  if( r > 0 && x1 > x0 && y1 > y0 )
+  {
+    ltigr_filter_job j;
+    int i = 0;
+    j.w = x1 - x0;
+    j.h = y1 - y0;
+    j.r = r;
+    /* three successive box passes approximate a gaussian kernel */
+    j.tmp = ltigr_scratch( L, (size_t)j.w * j.h * sizeof( TPixel ) );
+    j.tstride = j.w;
+    j.sums = ltigr_scratch( L, (size_t)j.w * 4 * sizeof( uint32_t ) );
+    j.out = dest->pix + (size_t)y0 * dest->w + x0;
+    j.ostride = dest->w;
+    j.in = src->pix + (size_t)y0 * src->w + x0;
+    j.istride = src->w;
+    for( i = 0; i < passes; ++i )
+    {
+      /* rows are split between threads for the horizontal pass, and
+       * columns for the vertical pass, so no two threads ever write
+       * the same pixel */
+      ltigr_parallel_for( j.h, nthreads, ltigr_blur_rows, &j );
+      ltigr_parallel_for( j.w, nthreads, ltigr_blur_cols, &j );
+      j.in = j.out;
+      j.istride = j.ostride;
+    }
+  }
+  return 0;
+}
+
+
+static void ltigr_check_lut( lua_State* L, int idx, uint8_t lut[ 256 ] )
+{
+  if( lua_isnoneornil( L, idx ) )
+  {
+    int i = 0;
+    for( i = 0; i < 256; ++i )
+    {
+      lut[ i ] = (uint8_t)i;
+    }
   }
   else
   {
-    /* __newindex */
-    luaL_error( L, "attempt to set read-only property 'ch'" );
+    size_t len = 0;
+    char const* s = luaL_checklstring( L, idx, &len );
+    luaL_argcheck( L, len == 256, idx, "256 byte lookup table expected" );
+    memcpy( lut, s, 256 );
+  }
+}
+
+
+static void ltigr_lut_rows( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  uint8_t const* lr = j->lut[ 0 ];
+  uint8_t const* lg = j->lut[ 1 ];
+  uint8_t const* lb = j->lut[ 2 ];
+  uint8_t const* la = j->lut[ 3 ];
+  int x = 0;
+  int y = 0;
+  for( y = begin; y < end; ++y )
+  {
+    TPixel const* in = j->in + (size_t)y * j->istride;
+    TPixel* out = j->out + (size_t)y * j->ostride;
+    for( x = 0; x < j->w; ++x )
+    {
+      TPixel p = in[ x ];
+      out[ x ].r = lr[ p.r ];
+      out[ x ].g = lg[ p.g ];
+      out[ x ].b = lb[ p.b ];
+      out[ x ].a = la[ p.a ];
+    }
+  }
+}
+
+
+static int ltigr_lut( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  uint8_t lr[ 256 ], lg[ 256 ], lb[ 256 ], la[ 256 ];
+  Tigr* src = NULL;
+  int nthreads = 1;
+  ltigr_filter_job j;
+  int x0, y0, x1, y1;
+  ltigr_check_lut( L, 2, lr );
+  ltigr_check_lut( L, 3, lg );
+  ltigr_check_lut( L, 4, lb );
+  ltigr_check_lut( L, 5, la );
+  src = ltigr_check_same_size( L, 6, dest );
+  nthreads = moon_optint( L, 7, 1, LTIGR_MAX_THREADS, 1 );
+  ltigr_clip_rect( dest, &x0, &y0, &x1, &y1 );
+  if( x1 > x0 && y1 > y0 )
+  {
+    j.in = src->pix + (size_t)y0 * src->w + x0;
+    j.istride = src->w;
+    j.out = dest->pix + (size_t)y0 * dest->w + x0;
+    j.ostride = dest->w;
+    j.w = x1 - x0;
+    j.lut[ 0 ] = lr;
+    j.lut[ 1 ] = lg;
+    j.lut[ 2 ] = lb;
+    j.lut[ 3 ] = la;
+    ltigr_parallel_for( y1 - y0, nthreads, ltigr_lut_rows, &j );
+  }
+  return 0;
+}
+
+
+/* area filter along one axis: maps sn source pixels onto dn output
+ * pixels, weighting each source pixel by its overlap */
+static void ltigr_area_line( TPixel const* in, ptrdiff_t istride, int sn,
+                             TPixel* out, ptrdiff_t ostride, int dn )
+{
+  int i = 0;
+  for( i = 0; i < dn; ++i )
+  {
+    /* coordinates in units of 1/(sn*dn) of the full line */
+    int64_t start = (int64_t)i * sn;
+    int64_t end = start + sn;
+    int64_t j = start / dn;
+    uint32_t ar = 0, ag = 0, ab = 0, aa = 0;
+    for( ; j * dn < end; ++j )
+    {
+      int64_t lo = j * dn > start ? j * dn : start;
+      int64_t hi = (j + 1) * dn < end ? (j + 1) * dn : end;
+      uint32_t wgt = (uint32_t)(hi - lo);
+      TPixel p = in[ j * istride ];
+      ar += wgt * p.r; ag += wgt * p.g; ab += wgt * p.b; aa += wgt * p.a;
+    }
+    out[ i * ostride ].r = (uint8_t)((ar + sn / 2) / sn);
+    out[ i * ostride ].g = (uint8_t)((ag + sn / 2) / sn);
+    out[ i * ostride ].b = (uint8_t)((ab + sn / 2) / sn);
+    out[ i * ostride ].a = (uint8_t)((aa + sn / 2) / sn);
+  }
+}
+
+
+/* box downscale of dest rows [begin, end); r holds the x factor and
+ * h the y factor */
+static void ltigr_downscale_box( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  int fx = j->r;
+  int fy = j->h;
+  uint32_t n = (uint32_t)fx * fy;
+  int x = 0;
+  int y = 0;
+  for( y = begin; y < end; ++y )
+  {
+    TPixel* out = j->out + (size_t)y * j->ostride;
+    for( x = 0; x < j->w; ++x )
+    {
+      uint32_t ar = 0, ag = 0, ab = 0, aa = 0;
+      int i = 0;
+      int k = 0;
+      for( k = 0; k < fy; ++k )
+      {
+        TPixel const* in = j->in + (size_t)(y * fy + k) * j->istride + (size_t)x * fx;
+        for( i = 0; i < fx; ++i )
+        {
+          ar += in[ i ].r; ag += in[ i ].g; ab += in[ i ].b; aa += in[ i ].a;
+        }
+      }
+      out[ x ].r = (uint8_t)((ar + n / 2) / n);
+      out[ x ].g = (uint8_t)((ag + n / 2) / n);
+      out[ x ].b = (uint8_t)((ab + n / 2) / n);
+      out[ x ].a = (uint8_t)((aa + n / 2) / n);
+    }
+  }
+}
+
+
+/* horizontal area pass over source rows [begin, end); r holds the
+ * source width */
+static void ltigr_downscale_rows( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  int y = 0;
+  for( y = begin; y < end; ++y )
+  {
+    ltigr_area_line( j->in + (size_t)y * j->istride, 1, j->r,
+                     j->tmp + (size_t)y * j->tstride, 1, j->w );
+  }
+}
+
+
+/* vertical area pass over dest columns [begin, end); r holds the
+ * source height */
+static void ltigr_downscale_cols( void* ctx, int begin, int end )
+{
+  ltigr_filter_job* j = ctx;
+  int x = 0;
+  for( x = begin; x < end; ++x )
+  {
+    ltigr_area_line( j->tmp + x, j->tstride, j->r,
+                     j->out + x, j->ostride, j->h );
+  }
+}
+
+
+static char const* const ltigr_downscale_names[] = {
+  "area",
+  "box",
+  NULL
+};
+
+
+static int ltigr_downscale( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
+  int box = luaL_checkoption( L, 3, "area", ltigr_downscale_names );
+  int nthreads = moon_optint( L, 4, 1, LTIGR_MAX_THREADS, 1 );
+  ltigr_filter_job j;
+  int x0, y0, x1, y1;
+  int dw = 0;
+  int dh = 0;
+  ltigr_clip_rect( dest, &x0, &y0, &x1, &y1 );
+  dw = x1 - x0;
+  dh = y1 - y0;
+  if( dw <= 0 || dh <= 0 )
+  {
     return 0;
   }
+  luaL_argcheck( L, src->pix != dest->pix, 2, "source and destination must differ" );
+  luaL_argcheck( L, src->w >= dw && src->h >= dh, 2,
+                 "source bitmap is smaller than destination" );
+  j.in = src->pix;
+  j.istride = src->w;
+  j.out = dest->pix + (size_t)y0 * dest->w + x0;
+  j.ostride = dest->w;
+  j.w = dw;
+  if( box )
+  {
+    int fx = src->w / dw;
+    int fy = src->h / dh;
+    luaL_argcheck( L, src->w == fx * dw && src->h == fy * dh, 2,
+                   "box filter needs an integer scale factor" );
+    j.r = fx;
+    j.h = fy;
+    ltigr_parallel_for( dh, nthreads, ltigr_downscale_box, &j );
+  }
+  else
+  {
+    /* separable: horizontal pass into a temporary, then vertical */
+    j.tmp = ltigr_scratch( L, (size_t)dw * src->h * sizeof( TPixel ) );
+    j.tstride = dw;
+    j.r = src->w;
+    ltigr_parallel_for( src->h, nthreads, ltigr_downscale_rows, &j );
+    j.r = src->h;
+    j.h = dh;
+    ltigr_parallel_for( dw, nthreads, ltigr_downscale_cols, &j );
+  }
+  return 0;
 }
 
 
-static int ltigr_bitmap_blitmode( lua_State* L )
+static int ltigr_upscale( lua_State* L )
+{
+  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
+  int f = moon_checkint( L, 3, 1, 16 );
+  int x0, y0, x1, y1;
+  int w = 0;
+  int h = 0;
+  int x = 0;
+  int y = 0;
+  luaL_argcheck( L, src->pix != dest->pix, 2, "source and destination must differ" );
+  ltigr_clip_rect( dest, &x0, &y0, &x1, &y1 );
+  /* the result is placed at the origin of the clip rectangle */
+  w = x1 - x0 < (int64_t)src->w * f ? x1 - x0 : src->w * f;
+  h = y1 - y0 < (int64_t)src->h * f ? y1 - y0 : src->h * f;
+  for( y = 0; y < h; ++y )
+  {
+    TPixel* out = dest->pix + (size_t)(y0 + y) * dest->w + x0;
+    if( y % f == 0 )
+    {
+      TPixel const* in = src->pix + (size_t)(y / f) * src->w;
+      switch( f )
+      {
+        case 2:
+          for( x = 0; x < w; ++x )
+          {
+            out[ x ] = in[ x >> 1 ];
+          }
+          break;
+        case 4:
+          for( x = 0; x < w; ++x )
+          {
+            out[ x ] = in[ x >> 2 ];
+          }
+          break;
+        default:
+          for( x = 0; x < w; ++x )
+          {
+            out[ x ] = in[ x / f ];
+          }
+          break;
+      }
+    }
+    else
+    {
+      memcpy( out, out - dest->w, (size_t)w * sizeof( TPixel ) );
+    }
+  }
+  return 0;
+}
+
+
+/* packed 1 bit per pixel collision mask, rows padded to whole words */
+typedef struct {
+  int w;
+  int h;
+  int stride; /* words per row */
+  uint64_t* bits;
+} ltigr_mask;
+
+
+static void ltigr_free_mask( void* p )
+{
+  ltigr_mask* m = p;
+  free( m->bits );
+}
+
+
+static int ltigr_mask_new( lua_State* L )
 {
   Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  if( lua_gettop( L ) < 3 )
+  uint8_t threshold = moon_optint( L, 2, 0, 255, 128 );
+  ltigr_mask* m = moon_newobject( L, "tigrMask", ltigr_free_mask );
+  int x = 0;
+  int y = 0;
+  m->w = bitmap->w;
+  m->h = bitmap->h;
+  m->stride = (bitmap->w + 63) / 64;
+  m->bits = calloc( (size_t)m->stride * m->h, sizeof( uint64_t ) );
+  if( !m->bits && m->stride > 0 && m->h > 0 )
   {
-    /* __index */
-    size_t i = 0;
-    for( i = 0; i < (sizeof( ltigr_blitmode_values )/sizeof( *ltigr_blitmode_values )); ++i )
+    luaL_error( L, "error creating tigrMask" );
+  }
+  for( y = 0; y < m->h; ++y )
+  {
+    TPixel const* in = bitmap->pix + (size_t)y * bitmap->w;
+    uint64_t* row = m->bits + (size_t)y * m->stride;
+    for( x = 0; x < m->w; ++x )
     {
-      if( bitmap->blitMode == ltigr_blitmode_values[ i ] )
+      row[ x >> 6 ] |= (uint64_t)(in[ x ].a >= threshold) << (x & 63);
+    }
+  }
+  return 1;
+}
+
+
+/* 64 mask bits of a row starting at column x (may be negative);
+ * columns outside of the row are zero */
+static inline uint64_t ltigr_mask_word( uint64_t const* row, int stride, int x )
+{
+  int i = x >> 6; /* floor division, also for negative x */
+  int s = x & 63;
+  uint64_t lo = (i >= 0 && i < stride) ? row[ i ] : 0;
+  uint64_t hi = (i + 1 >= 0 && i + 1 < stride) ? row[ i + 1 ] : 0;
+  return s ? (lo >> s) | (hi << (64 - s)) : lo;
+}
+
+
+/* does mask b placed at offset (dx, dy) relative to mask a overlap? */
+static int ltigr_mask_overlaps( ltigr_mask const* a, ltigr_mask const* b, int dx, int dy )
+{
+  int x0 = dx > 0 ? dx : 0;
+  int y0 = dy > 0 ? dy : 0;
+  int x1 = (int64_t)dx + b->w < a->w ? dx + b->w : a->w;
+  int y1 = (int64_t)dy + b->h < a->h ? dy + b->h : a->h;
+  int y = 0;
+  if( x0 >= x1 || y0 >= y1 )
+  {
+    return 0;
+  }
+  for( y = y0; y < y1; ++y )
+  {
+    uint64_t const* arow = a->bits + (size_t)y * a->stride;
+    uint64_t const* brow = b->bits + (size_t)(y - dy) * b->stride;
+    int x = x0 & ~63;
+    for( ; x < x1; x += 64 )
+    {
+      if( arow[ x >> 6 ] & ltigr_mask_word( brow, b->stride, x - dx ) )
       {
-        lua_pushstring( L, ltigr_blitmode_names[ i ] );
         return 1;
       }
     }
-#if 1
-    /* raising an error here is probably safest */
-    luaL_error( L, "unknown blitmode in bitmap/window" );
-#endif
-    lua_pushnil( L );
+  }
+  return 0;
+}
+
+
+static int ltigr_overlaps( lua_State* L )
+{
+  ltigr_mask* a = moon_checkobject( L, 1, "tigrMask" );
+  ltigr_mask* b = moon_checkobject( L, 2, "tigrMask" );
+  int dx = moon_checkint( L, 3, INT_MIN, INT_MAX );
+  int dy = moon_checkint( L, 4, INT_MIN, INT_MAX );
+  lua_pushboolean( L, ltigr_mask_overlaps( a, b, dx, dy ) );
+  return 1;
+}
+
+
+static int ltigr_collisions( lua_State* L )
+{
+  ltigr_mask* a = moon_checkobject( L, 1, "tigrMask" );
+  int n = 0;
+  int i = 0;
+  int hits = 0;
+  luaL_checktype( L, 2, LUA_TTABLE );
+  n = (int)lua_rawlen( L, 2 );
+  luaL_argcheck( L, n % 3 == 0, 2, "flat list of mask, dx, dy triples expected" );
+  lua_settop( L, 2 );
+  lua_newtable( L );
+  for( i = 0; i < n / 3; ++i )
+  {
+    ltigr_mask* b = NULL;
+    int dx = 0;
+    int dy = 0;
+    lua_rawgeti( L, 2, 3 * i + 1 );
+    lua_rawgeti( L, 2, 3 * i + 2 );
+    lua_rawgeti( L, 2, 3 * i + 3 );
+    b = ltigr_check_elem_object( L, -3, 2, NULL, 3 * i + 1, "tigrMask" );
+    dx = (int)ltigr_check_elem_int( L, -2, 2, NULL, 3 * i + 2, INT_MIN, INT_MAX );
+    dy = (int)ltigr_check_elem_int( L, -1, 2, NULL, 3 * i + 3, INT_MIN, INT_MAX );
+    lua_pop( L, 3 );
+    if( ltigr_mask_overlaps( a, b, dx, dy ) )
+    {
+      lua_pushinteger( L, i + 1 );
+      lua_rawseti( L, 3, ++hits );
+    }
+  }
+  return 1;
+}
+
+
+static int ltigr_mask_w( lua_State* L )
+{
+  ltigr_mask* m = moon_checkobject( L, 1, "tigrMask" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, m->w );
     return 1;
   }
   else
   {
     /* __newindex */
-    enum TIGRBlitMode mode = ltigr_blitmode_values[
-      luaL_checkoption( L, 3, NULL, ltigr_blitmode_names )
-    ];
-    tigrBlitMode( bitmap, mode );
+    luaL_error( L, "attempt to set read-only property 'w'" );
     return 0;
   }
 }
 
 
-static int ltigr_get( lua_State* L )
+static int ltigr_mask_h( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  lua_pushinteger( L, tp2p( tigrGet( bitmap, x, y ) ) );
-  return 1;
+  ltigr_mask* m = moon_checkobject( L, 1, "tigrMask" );
+  if( lua_gettop( L ) < 3 )
+  {
+    /* __index */
+    lua_pushinteger( L, m->h );
+    return 1;
+  }
+  else
+  {
+    /* __newindex */
+    luaL_error( L, "attempt to set read-only property 'h'" );
+    return 0;
+  }
 }
 
 
-static int ltigr_plot( lua_State* L )
+typedef struct {
+  Tigr* bitmap;
+  int x;
+  int y;
+  unsigned opacity; /* 0-255 */
+  int mode; /* one of ltigr_blitmode_values */
+  int dirty;
+  int has_draw; /* is there a redraw callback? */
+  uint8_t* opaque_rows; /* per row flag: all pixels fully opaque */
+  int opaque_h;
+} ltigr_layer;
+
+typedef struct {
+  Tigr* target;
+  ltigr_layer* layers;
+  int n;
+  int capacity;
+} ltigr_compositor;
+
+
+static void ltigr_free_compositor( void* p )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  TPixel pixel = check_pixel( L, 4 );
-  tigrPlot( bitmap, x, y, pixel );
-  return 0;
+  ltigr_compositor* c = p;
+  int i = 0;
+  for( i = 0; i < c->n; ++i )
+  {
+    free( c->layers[ i ].opaque_rows );
+  }
+  free( c->layers );
 }
 
 
-static int ltigr_clear( lua_State* L )
+static int ltigr_compositor_new( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  TPixel color = check_pixel( L, 2 );
-  tigrClear( bitmap, color );
-  return 0;
+  Tigr* target = moon_checkobject( L, 1, "tigrBitmap" );
+  ltigr_compositor* c = moon_newobject( L, "tigrCompositor", ltigr_free_compositor );
+  c->target = target;
+  c->layers = NULL;
+  c->n = 0;
+  c->capacity = 0;
+  lua_pushvalue( L, 1 );
+  moon_setuvfield( L, -2, "target" );
+  lua_newtable( L );
+  moon_setuvfield( L, -2, "layers" );
+  return 1;
 }
 
 
-static int ltigr_fill( lua_State* L )
+static ltigr_layer* ltigr_check_layer( lua_State* L, int idx, ltigr_compositor* c )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  int w = moon_checkint( L, 4, 0, INT_MAX );
-  int h = moon_checkint( L, 5, 0, INT_MAX );
-  TPixel color = check_pixel( L, 6 );
-  tigrFill( bitmap, x, y, w, h, color );
-  return 0;
+  int i = moon_checkint( L, idx, 1, c->n > 0 ? c->n : 1 );
+  luaL_argcheck( L, i <= c->n, idx, "invalid layer index" );
+  return c->layers + (i - 1);
 }
 
 
-static int ltigr_line( lua_State* L )
+/* layers are anchored in the "layers" table of the uservalue at
+ * index i (bitmap) and -i (draw callback) */
+static int ltigr_compositor_add( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x0 = moon_checkint( L, 2, 0, INT_MAX );
-  int y0 = moon_checkint( L, 3, 0, INT_MAX );
-  int x1 = moon_checkint( L, 4, 0, INT_MAX );
-  int y1 = moon_checkint( L, 5, 0, INT_MAX );
-  TPixel color = check_pixel( L, 6 );
-  tigrLine( bitmap, x0, y0, x1, y1, color );
-  return 0;
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  Tigr* bitmap = moon_checkobject( L, 2, "tigrBitmap" );
+  ltigr_layer* layer = NULL;
+  luaL_argcheck( L, bitmap->pix != c->target->pix, 2, "compositor target used as layer" );
+  if( !lua_isnoneornil( L, 3 ) )
+  {
+    luaL_checktype( L, 3, LUA_TFUNCTION );
+  }
+  lua_settop( L, 3 );
+  if( c->n == c->capacity )
+  {
+    int capacity = c->capacity ? 2 * c->capacity : 8;
+    ltigr_layer* layers = realloc( c->layers, capacity * sizeof( ltigr_layer ) );
+    if( !layers )
+    {
+      luaL_error( L, "memory allocation error" );
+    }
+    c->layers = layers;
+    c->capacity = capacity;
+  }
+  layer = c->layers + c->n;
+  layer->bitmap = bitmap;
+  layer->x = 0;
+  layer->y = 0;
+  layer->opacity = 255u;
+  layer->mode = TIGR_BLEND_ALPHA;
+  layer->dirty = 1;
+  layer->has_draw = !lua_isnil( L, 3 );
+  layer->opaque_rows = NULL;
+  layer->opaque_h = 0;
+  ++c->n;
+  moon_getuvfield( L, 1, "layers" );
+  lua_pushvalue( L, 2 );
+  lua_rawseti( L, -2, c->n );
+  lua_pushvalue( L, 3 );
+  lua_rawseti( L, -2, -c->n );
+  lua_pop( L, 1 );
+  lua_pushinteger( L, c->n );
+  return 1;
 }
 
 
-static int ltigr_rect( lua_State* L )
+static int ltigr_compositor_move( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  int w = moon_checkint( L, 4, 0, INT_MAX );
-  int h = moon_checkint( L, 5, 0, INT_MAX );
-  TPixel color = check_pixel( L, 6 );
-  tigrRect( bitmap, x, y, w, h, color );
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  ltigr_layer* layer = ltigr_check_layer( L, 2, c );
+  layer->x = moon_checkint( L, 3, INT_MIN / 2, INT_MAX / 2 );
+  layer->y = moon_checkint( L, 4, INT_MIN / 2, INT_MAX / 2 );
   return 0;
 }
 
 
-static int ltigr_fill_rect( lua_State* L )
+static int ltigr_compositor_opacity( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  int w = moon_checkint( L, 4, 0, INT_MAX );
-  int h = moon_checkint( L, 5, 0, INT_MAX );
-  TPixel color = check_pixel( L, 6 );
-  tigrFillRect( bitmap, x, y, w, h, color );
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  ltigr_layer* layer = ltigr_check_layer( L, 2, c );
+  layer->opacity = ltigr_alpha8( (float)luaL_checknumber( L, 3 ) );
   return 0;
 }
 
 
-static int ltigr_circle( lua_State* L )
+static int ltigr_compositor_blitmode( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  int r = moon_checkint( L, 4, 0, INT_MAX );
-  TPixel color = check_pixel( L, 5 );
-  tigrCircle( bitmap, x, y, r, color );
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  ltigr_layer* layer = ltigr_check_layer( L, 2, c );
+  layer->mode = ltigr_blitmode_values[
+    luaL_checkoption( L, 3, "blend_alpha", ltigr_blitmode_names )
+  ];
   return 0;
 }
 
 
-static int ltigr_fill_circle( lua_State* L )
+static int ltigr_compositor_invalidate( lua_State* L )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int x = moon_checkint( L, 2, 0, INT_MAX );
-  int y = moon_checkint( L, 3, 0, INT_MAX );
-  int r = moon_checkint( L, 4, 0, INT_MAX );
-  TPixel color = check_pixel( L, 5 );
-  tigrFillCircle( bitmap, x, y, r, color );
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  ltigr_layer* layer = ltigr_check_layer( L, 2, c );
+  layer->dirty = 1;
   return 0;
 }
 
 
-static int ltigr_clip( lua_State* L )
+static void ltigr_update_opaque_rows( lua_State* L, ltigr_layer* layer )
 {
-  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
-  int cx = moon_checkint( L, 2, 0, INT_MAX );
-  int cy = moon_checkint( L, 3, 0, INT_MAX );
-  int cw = moon_checkint( L, 4, -1, INT_MAX );
-  int ch = moon_checkint( L, 5, -1, INT_MAX );
-  tigrClip( bitmap, cx, cy, cw, ch );
-  return 0;
+  Tigr* bitmap = layer->bitmap;
+  int x = 0;
+  int y = 0;
+  if( layer->opaque_h != bitmap->h )
+  {
+    uint8_t* rows = realloc( layer->opaque_rows, bitmap->h > 0 ? bitmap->h : 1 );
+    if( !rows )
+    {
+      luaL_error( L, "memory allocation error" );
+    }
+    layer->opaque_rows = rows;
+    layer->opaque_h = bitmap->h;
+  }
+  for( y = 0; y < bitmap->h; ++y )
+  {
+    TPixel const* row = bitmap->pix + (size_t)y * bitmap->w;
+    unsigned a = 0xFFu;
+    for( x = 0; x < bitmap->w; ++x )
+    {
+      a &= row[ x ].a;
+    }
+    layer->opaque_rows[ y ] = a == 0xFFu;
+  }
 }
 
 
-static int ltigr_blit( lua_State* L )
+/* Composites all layers into the target. For every target row only
+ * the topmost layer that covers the whole row opaquely and everything
+ * above it are drawn, so hidden pixels are never touched. Rows without
+ * such a layer are cleared to transparent black first. */
+static int ltigr_compositor_flatten( lua_State* L )
 {
-  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
-  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
-  int dx = moon_checkint( L, 3, 0, INT_MAX );
-  int dy = moon_checkint( L, 4, 0, INT_MAX );
-  int sx = moon_checkint( L, 5, 0, INT_MAX );
-  int sy = moon_checkint( L, 6, 0, INT_MAX );
-  int w = moon_checkint( L, 7, 0, INT_MAX );
-  int h = moon_checkint( L, 8, 0, INT_MAX );
-  tigrBlit( dest, src, dx, dy, sx, sy, w, h );
+  ltigr_compositor* c = moon_checkobject( L, 1, "tigrCompositor" );
+  Tigr* target = c->target;
+  TPixel const white = tigrRGBA( 0xFF, 0xFF, 0xFF, 0xFF );
+  int x0, y0, x1, y1;
+  int i = 0;
+  int y = 0;
+  for( i = 0; i < c->n; ++i )
+  {
+    if( c->layers[ i ].dirty )
+    {
+      if( c->layers[ i ].has_draw )
+      {
+        moon_getuvfield( L, 1, "layers" );
+        lua_rawgeti( L, -1, -(i + 1) );
+        lua_rawgeti( L, -2, i + 1 );
+        lua_call( L, 1, 0 );
+        lua_pop( L, 1 );
+      }
+      /* the callback may have added layers, so refetch */
+      ltigr_update_opaque_rows( L, c->layers + i );
+      c->layers[ i ].dirty = 0;
+    }
+  }
+  ltigr_clip_rect( target, &x0, &y0, &x1, &y1 );
+  for( y = y0; y < y1; ++y )
+  {
+    TPixel* out = target->pix + (size_t)y * target->w;
+    int start = 0;
+    for( i = c->n - 1; i >= 0; --i )
+    {
+      ltigr_layer const* l = c->layers + i;
+      int ly = y - l->y;
+      if( l->opacity == 255u && l->mode == TIGR_BLEND_ALPHA &&
+          ly >= 0 && ly < l->bitmap->h && l->opaque_rows[ ly ] &&
+          l->x <= x0 && l->x + l->bitmap->w >= x1 )
+      {
+        memcpy( out + x0, l->bitmap->pix + (size_t)ly * l->bitmap->w + (x0 - l->x),
+                (size_t)(x1 - x0) * sizeof( TPixel ) );
+        start = i + 1;
+        break;
+      }
+    }
+    if( start == 0 )
+    {
+      /* nothing covers the row, so start from transparent black */
+      memset( out + x0, 0, (size_t)(x1 - x0) * sizeof( TPixel ) );
+    }
+    for( i = start; i < c->n; ++i )
+    {
+      ltigr_layer const* l = c->layers + i;
+      int ly = y - l->y;
+      int lx0 = l->x > x0 ? l->x : x0;
+      int lx1 = l->x + l->bitmap->w < x1 ? l->x + l->bitmap->w : x1;
+      if( l->opacity > 0 && ly >= 0 && ly < l->bitmap->h && lx0 < lx1 )
+      {
+        ltigr_blend_span( out + lx0, l->bitmap->pix + (size_t)ly * l->bitmap->w + (lx0 - l->x),
+                          1, lx1 - lx0, l->mode, white, l->opacity );
+      }
+    }
+  }
   return 0;
 }
 
 
-static int ltigr_blit_alpha( lua_State* L )
+/* content hash of the pixels in the clip rectangle: four independent
+ * multiply-xor lanes (to keep the pipeline busy) that are mixed at
+ * the end, returned as a hex string to avoid precision issues with
+ * Lua numbers */
+static uint64_t ltigr_mix64( uint64_t h )
 {
-  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
-  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
-  int dx = moon_checkint( L, 3, 0, INT_MAX );
-  int dy = moon_checkint( L, 4, 0, INT_MAX );
-  int sx = moon_checkint( L, 5, 0, INT_MAX );
-  int sy = moon_checkint( L, 6, 0, INT_MAX );
-  int w = moon_checkint( L, 7, 0, INT_MAX );
-  int h = moon_checkint( L, 8, 0, INT_MAX );
-  float alpha = (float)luaL_checknumber( L, 9 );
-  tigrBlitAlpha( dest, src, dx, dy, sx, sy, w, h, alpha );
-  return 0;
+  h ^= h >> 33;
+  h *= UINT64_C( 0xff51afd7ed558ccd );
+  h ^= h >> 33;
+  h *= UINT64_C( 0xc4ceb9fe1a85ec53 );
+  h ^= h >> 33;
+  return h;
 }
 
 
-static int ltigr_blit_tint( lua_State* L )
+static int ltigr_hash( lua_State* L )
 {
-  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
-  Tigr* src = moon_checkobject( L, 2, "tigrBitmap" );
-  int dx = moon_checkint( L, 3, 0, INT_MAX );
-  int dy = moon_checkint( L, 4, 0, INT_MAX );
-  int sx = moon_checkint( L, 5, 0, INT_MAX );
-  int sy = moon_checkint( L, 6, 0, INT_MAX );
-  int w = moon_checkint( L, 7, 0, INT_MAX );
-  int h = moon_checkint( L, 8, 0, INT_MAX );
-  TPixel tint = check_pixel( L, 9 );
-  tigrBlitTint( dest, src, dx, dy, sx, sy, w, h, tint );
-  return 0;
+  Tigr* bitmap = moon_checkobject( L, 1, "tigrBitmap" );
+  uint64_t const prime = UINT64_C( 0x100000001b3 );
+  uint64_t lane[ 4 ] = {
+    UINT64_C( 0xcbf29ce484222325 ), UINT64_C( 0x9e3779b97f4a7c15 ),
+    UINT64_C( 0x2545f4914f6cdd1d ), UINT64_C( 0x94d049bb133111eb )
+  };
+  uint64_t h = 0;
+  int x0, y0, x1, y1;
+  int x = 0;
+  int y = 0;
+  char buffer[ 17 ];
+  ltigr_clip_rect( bitmap, &x0, &y0, &x1, &y1 );
+  for( y = y0; y < y1; ++y )
+  {
+    TPixel const* row = bitmap->pix + (size_t)y * bitmap->w;
+    for( x = x0; x + 3 < x1; x += 4 )
+    {
+      lane[ 0 ] = (lane[ 0 ] ^ tp2p( row[ x ] )) * prime;
+      lane[ 1 ] = (lane[ 1 ] ^ tp2p( row[ x + 1 ] )) * prime;
+      lane[ 2 ] = (lane[ 2 ] ^ tp2p( row[ x + 2 ] )) * prime;
+      lane[ 3 ] = (lane[ 3 ] ^ tp2p( row[ x + 3 ] )) * prime;
+    }
+    for( ; x < x1; ++x )
+    {
+      lane[ 0 ] = (lane[ 0 ] ^ tp2p( row[ x ] )) * prime;
+    }
+  }
+  h = ltigr_mix64( (uint64_t)(x1 - x0) << 32 | (uint32_t)(y1 - y0) );
+  for( x = 0; x < 4; ++x )
+  {
+    h = ltigr_mix64( h ^ lane[ x ] );
+  }
+  for( x = 15; x >= 0; --x, h >>= 4 )
+  {
+    buffer[ x ] = "0123456789abcdef"[ h & 0xFu ];
+  }
+  buffer[ 16 ] = '\0';
+  lua_pushstring( L, buffer );
+  return 1;
 }
 
 
-static int ltigr_blitmode( lua_State* L )
+/* compares the clip rectangle of a bitmap with another bitmap of the
+ * same size; returns the number of pixels whose largest channel
+ * difference exceeds the tolerance, the largest difference, and the
+ * bounding box of the mismatches (if any) */
+static int ltigr_diff( lua_State* L )
 {
-  Tigr* dest = moon_checkobject( L, 1, "tigrBitmap" );
-  enum TIGRBlitMode mode = ltigr_blitmode_values[
-      luaL_checkoption( L, 2, "blend_alpha", ltigr_blitmode_names )
-  ];
-  tigrBlitMode( dest, mode );
-  return 0;
+  Tigr* a = moon_checkobject( L, 1, "tigrBitmap" );
+  Tigr* b = moon_checkobject( L, 2, "tigrBitmap" );
+  int tol = 0;
+  Tigr* out = NULL;
+  lua_Integer count = 0;
+  int maxd = 0;
+  int bx0 = INT_MAX, by0 = INT_MAX, bx1 = -1, by1 = -1;
+  int x0, y0, x1, y1;
+  int x = 0;
+  int y = 0;
+  luaL_argcheck( L, a->w == b->w && a->h == b->h, 2, "bitmap size mismatch" );
+  if( !lua_isnoneornil( L, 3 ) )
+  {
+    luaL_checktype( L, 3, LUA_TTABLE );
+    lua_getfield( L, 3, "tolerance" );
+    tol = lua_isnil( L, -1 ) ? 0 : (int)ltigr_check_elem_int( L, -1, 3, "tolerance", 0, 0, 255 );
+    if( LUA_TNIL != lua_getfield( L, 3, "output" ) )
+    {
+      out = ltigr_check_elem_object( L, -1, 3, "output", 0, "tigrBitmap" );
+      luaL_argcheck( L, out->w == a->w && out->h == a->h, 3,
+                     "output bitmap size mismatch" );
+    }
+  }
+  ltigr_clip_rect( a, &x0, &y0, &x1, &y1 );
+  for( y = y0; y < y1; ++y )
+  {
+    TPixel const* ra = a->pix + (size_t)y * a->w;
+    TPixel const* rb = b->pix + (size_t)y * b->w;
+    TPixel* ro = out ? out->pix + (size_t)y * out->w : NULL;
+    int first = -1;
+    int last = -1;
+    for( x = x0; x < x1; ++x )
+    {
+      int dr = ra[ x ].r > rb[ x ].r ? ra[ x ].r - rb[ x ].r : rb[ x ].r - ra[ x ].r;
+      int dg = ra[ x ].g > rb[ x ].g ? ra[ x ].g - rb[ x ].g : rb[ x ].g - ra[ x ].g;
+      int db = ra[ x ].b > rb[ x ].b ? ra[ x ].b - rb[ x ].b : rb[ x ].b - ra[ x ].b;
+      int da = ra[ x ].a > rb[ x ].a ? ra[ x ].a - rb[ x ].a : rb[ x ].a - ra[ x ].a;
+      int d = dr > dg ? dr : dg;
+      d = d > db ? d : db;
+      d = d > da ? d : da;
+      maxd = d > maxd ? d : maxd;
+      if( d > tol )
+      {
+        ++count;
+        first = first < 0 ? x : first;
+        last = x;
+      }
+      if( ro )
+      {
+        /* mismatches in red, everything else as dimmed gray */
+        uint8_t v = (uint8_t)((ra[ x ].r * 77u + ra[ x ].g * 150u + ra[ x ].b * 29u) >> 10);
+        ro[ x ] = d > tol ? tigrRGBA( 0xFF, 0, 0, 0xFF ) : tigrRGBA( v, v, v, 0xFF );
+      }
+    }
+    if( first >= 0 )
+    {
+      bx0 = first < bx0 ? first : bx0;
+      bx1 = last > bx1 ? last : bx1;
+      by0 = y < by0 ? y : by0;
+      by1 = y;
+    }
+  }
+  lua_pushinteger( L, count );
+  lua_pushinteger( L, maxd );
+  if( count > 0 )
+  {
+    lua_pushinteger( L, bx0 );
+    lua_pushinteger( L, by0 );
+    lua_pushinteger( L, bx1 - bx0 + 1 );
+    lua_pushinteger( L, by1 - by0 + 1 );
+    return 6;
+  }
+  return 2;
 }
 
 
@@ -522,7 +3803,14 @@ static int ltigr_print( lua_State* L )
   int y = moon_checkint( L, 4, 0, INT_MAX );
   TPixel color = check_pixel( L, 5 );
   char const* text = luaL_checkstring( L, 6 );
+  int mode = bitmap->blitMode;
+  if( ltigr_is_custom_blitmode( mode ) )
+  {
+    /* Tigr's text rendering only knows about its own blit modes */
+    tigrBlitMode( bitmap, TIGR_BLEND_ALPHA );
+  }
   tigrPrint( bitmap, font, x, y, color, "%s", text );
+  bitmap->blitMode = mode;
   return 0;
 }
 
@@ -544,7 +3832,17 @@ static int ltigr_mouse( lua_State* L )
   int x = 0;
   int y = 0;
   int buttons = 0;
-  tigrMouse( window, &x, &y, &buttons );
+  ltigr_input* in = ltigr_input_session( L, window );
+  if( in )
+  {
+    x = in->mx;
+    y = in->my;
+    buttons = in->buttons;
+  }
+  else
+  {
+    tigrMouse( window, &x, &y, &buttons );
+  }
   lua_pushinteger( L, x );
   lua_pushinteger( L, y );
   lua_pushinteger( L, buttons );
@@ -557,7 +3855,17 @@ static int ltigr_touch( lua_State* L )
   Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
   TigrTouchPoint points[ 10 ];
   int i = 0;
-  int num = tigrTouch( window, points, sizeof( points )/sizeof( *points ) );
+  ltigr_input* in = ltigr_input_session( L, window );
+  int num = 0;
+  if( in )
+  {
+    num = in->ntouch;
+    memcpy( points, in->touch, num * sizeof( *points ) );
+  }
+  else
+  {
+    num = tigrTouch( window, points, sizeof( points )/sizeof( *points ) );
+  }
   lua_createtable( L, num, 0 );
   for ( i = 0; i < num; ++i )
   {
@@ -666,6 +3974,7 @@ static int ltigr_key_down( lua_State* L )
   size_t len = 0;
   char const* keyname = luaL_checklstring( L, 2, &len );
   int keycode = 0;
+  ltigr_input* in = NULL;
   lua_settop( L, 2 );
   if( len == 1 && ((keyname[ 0 ] >= 'a' && keyname[ 0 ] <= 'z')
                 || (keyname[ 0 ] >= 'A' && keyname[ 0 ] <= 'Z')
@@ -682,7 +3991,8 @@ static int ltigr_key_down( lua_State* L )
     lua_pushnil( L );
     return 1;
   }
-  lua_pushboolean( L, tigrKeyDown( window, keycode ) );
+  in = ltigr_input_session( L, window );
+  lua_pushboolean( L, in ? (in->keys[ keycode ] & 1) : tigrKeyDown( window, keycode ) );
   return 1;
 }
 
@@ -693,6 +4003,7 @@ static int ltigr_key_held( lua_State* L )
   size_t len = 0;
   char const* keyname = luaL_checklstring( L, 2, &len );
   int keycode = 0;
+  ltigr_input* in = NULL;
   lua_settop( L, 2 );
   if( len == 1 && ((keyname[ 0 ] >= 'a' && keyname[ 0 ] <= 'z')
                 || (keyname[ 0 ] >= 'A' && keyname[ 0 ] <= 'Z')
@@ -709,7 +4020,8 @@ static int ltigr_key_held( lua_State* L )
     lua_pushnil( L );
     return 1;
   }
-  lua_pushboolean( L, tigrKeyHeld( window, keycode ) );
+  in = ltigr_input_session( L, window );
+  lua_pushboolean( L, in ? (in->keys[ keycode ] & 2) : tigrKeyHeld( window, keycode ) );
   return 1;
 }
 
@@ -717,7 +4029,17 @@ static int ltigr_key_held( lua_State* L )
 static int ltigr_read_char( lua_State* L )
 {
   Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
-  int keycode = tigrReadChar( window );
+  ltigr_input* in = ltigr_input_session( L, window );
+  int keycode = 0;
+  if( in )
+  {
+    keycode = in->chr;
+    in->chr = 0;
+  }
+  else
+  {
+    keycode = tigrReadChar( window );
+  }
   if( keycode == 0 )
   {
     lua_pushnil( L );
@@ -730,6 +4052,89 @@ static int ltigr_read_char( lua_State* L )
 }
 
 
+static int ltigr_input_start( lua_State* L, int replay )
+{
+  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
+  char const* filename = luaL_checkstring( L, 2 );
+  ltigr_input* in = NULL;
+  luaL_argcheck( L, ltigr_input_session( L, NULL ) == NULL, 1,
+                 "input recording/replay already active" );
+  in = moon_newobject( L, "tigrInputSession", ltigr_input_close );
+  memset( in, 0, sizeof( *in ) );
+  in->window = window;
+  in->replay = replay;
+  in->file = fopen( filename, replay ? "rb" : "wb" );
+  if( !in->file )
+  {
+    return luaL_fileresult( L, 0, filename );
+  }
+  if( replay )
+  {
+    char magic[ sizeof( ltigr_input_magic ) ];
+    if( fread( magic, 1, sizeof( magic ), in->file ) != sizeof( magic ) ||
+        memcmp( magic, ltigr_input_magic, sizeof( magic ) ) != 0 )
+    {
+      ltigr_input_close( in );
+      lua_pushnil( L );
+      lua_pushfstring( L, "%s: not an input log", filename );
+      return 2;
+    }
+    if( !ltigr_input_read_state( in ) || !ltigr_input_read_times( in ) )
+    {
+      in->finished = 1;
+    }
+  }
+  else
+  {
+    fwrite( ltigr_input_magic, 1, sizeof( ltigr_input_magic ), in->file );
+    ltigr_input_snapshot( in );
+    ltigr_input_write_state( in );
+  }
+  /* keep the window alive as long as the session */
+  lua_pushvalue( L, 1 );
+  moon_setuvfield( L, -2, "window" );
+  lua_setfield( L, LUA_REGISTRYINDEX, "ltigr.input" );
+  lua_pushboolean( L, 1 );
+  return 1;
+}
+
+
+static int ltigr_record_input( lua_State* L )
+{
+  return ltigr_input_start( L, 0 );
+}
+
+
+static int ltigr_replay_input( lua_State* L )
+{
+  return ltigr_input_start( L, 1 );
+}
+
+
+static int ltigr_stop_input( lua_State* L )
+{
+  Tigr* window = moon_checkobject( L, 1, "tigrWindow" );
+  ltigr_input* in = ltigr_input_session( L, window );
+  int ok = 1;
+  if( in )
+  {
+    if( !in->replay && in->file )
+    {
+      ltigr_input_write_times( in );
+      ok = !ferror( in->file );
+    }
+    if( in->file )
+    {
+      ok = fclose( in->file ) == 0 && ok;
+      in->file = NULL;
+    }
+    lua_pushnil( L );
+    lua_setfield( L, LUA_REGISTRYINDEX, "ltigr.input" );
+  }
+  return luaL_fileresult( L, ok, NULL );
+}
+
+
 static int ltigr_load_image( lua_State* L )
 {
   char const* filename = luaL_checkstring( L, 1 );
@@ -772,7 +4177,33 @@ static int ltigr_save_image( lua_State* L )
 
 static int ltigr_time( lua_State* L )
 {
-  lua_pushnumber( L, tigrTime() );
+  ltigr_input* in = ltigr_input_session( L, NULL );
+  float t = 0.0f;
+  if( in && in->replay && !in->finished )
+  {
+    if( in->itime >= in->ntimes )
+    {
+      return luaL_error( L, "input replay out of sync: more tigr.time calls than recorded" );
+    }
+    t = in->times[ in->itime++ ];
+  }
+  else
+  {
+    t = tigrTime();
+    if( in && !in->replay && in->file )
+    {
+      if( in->ntimes >= LTIGR_INPUT_MAX_TIMES )
+      {
+        return luaL_error( L, "too many tigr.time calls in one frame while recording input" );
+      }
+      if( !ltigr_input_reserve( in, in->ntimes + 1 ) )
+      {
+        return luaL_error( L, "memory allocation error" );
+      }
+      in->times[ in->ntimes++ ] = t;
+    }
+  }
+  lua_pushnumber( L, t );
   return 1;
 }
 
@@ -805,17 +4236,29 @@ static int ltigr_error( lua_State* L ) {
   { "clear", ltigr_clear }, \
   { "fill", ltigr_fill }, \
   { "line", ltigr_line }, \
+  { "polyline", ltigr_polyline }, \
   { "rect", ltigr_rect }, \
   { "fill_rect", ltigr_fill_rect }, \
+  { "fill_gradient", ltigr_fill_gradient }, \
+  { "fill_pattern", ltigr_fill_pattern }, \
   { "circle", ltigr_circle }, \
   { "fill_circle", ltigr_fill_circle }, \
+  { "flood_fill", ltigr_flood_fill }, \
+  { "region", ltigr_region }, \
   { "clip", ltigr_clip }, \
   { "blit", ltigr_blit }, \
   { "blit_alpha", ltigr_blit_alpha }, \
   { "blit_tint", ltigr_blit_tint }, \
+  { "blur", ltigr_blur }, \
+  { "lut", ltigr_lut }, \
+  { "downscale", ltigr_downscale }, \
+  { "upscale", ltigr_upscale }, \
+  { "hash", ltigr_hash }, \
+  { "diff", ltigr_diff }, \
   { "load_font", ltigr_load_font }, \
   { "print", ltigr_print }, \
-  { "save_image", ltigr_save_image }
+  { "save_image", ltigr_save_image }, \
+  { "export", ltigr_export }
 
 #define WINDOW_METHODS \
   { "closed", ltigr_closed }, \
@@ -823,8 +4266,33 @@ static int ltigr_error( lua_State* L ) {
   { "mouse", ltigr_mouse }, \
   { "touch", ltigr_touch }, \
   { "read_char", ltigr_read_char }, \
+  { "record_input", ltigr_record_input }, \
+  { "replay_input", ltigr_replay_input }, \
+  { "stop_input", ltigr_stop_input }, \
   { "error", ltigr_error }
 
+#define SHARED_METHODS \
+  { "export_handle", ltigr_shared_export }, \
+  { "lock", ltigr_shared_lock }, \
+  { "try_lock", ltigr_shared_try_lock }, \
+  { "unlock", ltigr_shared_unlock }
+
+#define MASK_PROPERTIES \
+  { ".w", ltigr_mask_w }, \
+  { ".h", ltigr_mask_h }
+
+#define MASK_METHODS \
+  { "overlaps", ltigr_overlaps }, \
+  { "collisions", ltigr_collisions }
+
+#define COMPOSITOR_METHODS \
+  { "add", ltigr_compositor_add }, \
+  { "move", ltigr_compositor_move }, \
+  { "opacity", ltigr_compositor_opacity }, \
+  { "layer_blitmode", ltigr_compositor_blitmode }, \
+  { "invalidate", ltigr_compositor_invalidate }, \
+  { "flatten", ltigr_compositor_flatten }
+
 #define FONT_METHODS \
   { "text_width", ltigr_text_width }, \
   { "text_height", ltigr_text_height }
@@ -840,12 +4308,20 @@ EXPORT int luaopen_tigr( lua_State* L )
     /* constructors */
     { "window", ltigr_window },
     { "bitmap", ltigr_bitmap },
+    { "shared_bitmap", ltigr_shared_bitmap },
+    { "import_bitmap", ltigr_import_bitmap },
+    { "mask", ltigr_mask_new },
+    { "compositor", ltigr_compositor_new },
     /* the font constructor is actually (also) a method of bitmap and included down below */
     { "load_image", ltigr_load_image },
     { "load_image_mem", ltigr_load_image_mem },
+    { "bitmap_from", ltigr_bitmap_from },
     /* aliases to the various methods */
     WINDOW_METHODS,
     BITMAP_METHODS,
+    SHARED_METHODS,
+    MASK_METHODS,
+    COMPOSITOR_METHODS,
     FONT_METHODS,
     /* misc functions */
     { "blitmode", ltigr_blitmode }, /* function variant of the bitmap property */
@@ -869,14 +4345,39 @@ EXPORT int luaopen_tigr( lua_State* L )
     BITMAP_METHODS,
     { NULL, NULL }
   };
+  luaL_Reg const shared_methods[] = {
+    BITMAP_PROPERTIES,
+    BITMAP_METHODS,
+    SHARED_METHODS,
+    { NULL, NULL }
+  };
+  luaL_Reg const mask_methods[] = {
+    MASK_PROPERTIES,
+    MASK_METHODS,
+    { NULL, NULL }
+  };
+  luaL_Reg const compositor_methods[] = {
+    COMPOSITOR_METHODS,
+    { NULL, NULL }
+  };
+  luaL_Reg const input_methods[] = {
+    { NULL, NULL }
+  };
   luaL_Reg const font_methods[] = {
     FONT_METHODS,
     { NULL, NULL }
   };
   moon_defobject( L, "tigrWindow", 0, window_methods, 0 );
   moon_defobject( L, "tigrBitmap", 0, bitmap_methods, 0 );
+  moon_defobject( L, "tigrSharedBitmap", sizeof( ltigr_shared_handle ),
+                  shared_methods, 0 );
+  moon_defobject( L, "tigrMask", sizeof( ltigr_mask ), mask_methods, 0 );
+  moon_defobject( L, "tigrCompositor", sizeof( ltigr_compositor ),
+                  compositor_methods, 0 );
+  moon_defobject( L, "tigrInputSession", sizeof( ltigr_input ), input_methods, 0 );
   moon_defobject( L, "tigrFont", 0, font_methods, 0 );
   moon_defcast( L, "tigrWindow", "tigrBitmap", ltigr_window_to_bitmap );
+  moon_defcast( L, "tigrSharedBitmap", "tigrBitmap", ltigr_shared_to_bitmap );
   luaL_newlib( L, module_functions );
   /* add the keyboard functions with the keycode table as upvalue */
   push_keycode_table( L );